@@ -0,0 +1,308 @@
+#include "BarchArchive.h"
+#include "ByteStream.h"
+
+using namespace::ImageCompressor;
+
+namespace
+{
+const char ARCHIVE_MAGIC[4] = {'B', 'A', 'R', 'A'};
+const char INDEX_MAGIC[4] = {'B', 'A', 'I', 'X'};
+const uint32_t ARCHIVE_VERSION = 1;
+const uint64_t HEADER_SIZE = sizeof(ARCHIVE_MAGIC) + sizeof(uint32_t);
+const uint64_t TRAILER_SIZE = sizeof(uint64_t) + sizeof(INDEX_MAGIC);
+const size_t TRAILER_SEARCH_CHUNK = 64 * 1024; // bytes read at a time while looking for the last complete trailer
+}
+
+BarchArchive::BarchArchive(const std::string& path, ArchiveMode mode) : path{path}, mode{mode}, indexOffset{HEADER_SIZE}, fileEnd{HEADER_SIZE}
+{
+    std::ios::openmode openMode = mode == ArchiveMode::APPEND ? std::ios::in | std::ios::out | std::ios::binary : std::ios::in | std::ios::binary;
+    file.open(path, openMode);
+
+    if(file.is_open())
+    {
+        readIndex();
+        return;
+    }
+
+    // only a file which isn't there is created, one which can't be written is left as it is
+    if(mode != ArchiveMode::APPEND || std::ifstream(path).is_open())
+    {
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+
+    file.clear();
+    file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if(!file.is_open())
+    {
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+
+    std::vector<BYTE> header;
+    Detail::ByteWriter writer(header);
+    writer.writeBytes(ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    writer.write<uint32_t>(ARCHIVE_VERSION);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+    writeIndex(HEADER_SIZE);
+}
+
+const ArchiveEntry* BarchArchive::findEntry(const std::string& name) const
+{
+    for(const ArchiveEntry& entry : entries)
+    {
+        if(entry.name == name)
+        {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+void BarchArchive::append(const std::string& name, const BarchImage& image)
+{
+    appendSerialized(name, serializeImage(image));
+}
+
+void BarchArchive::appendSerialized(const std::string& name, const std::vector<BYTE>& serializedImage)
+{
+    if(mode != ArchiveMode::APPEND)
+    {
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+
+    if(findEntry(name))
+    {
+        throw ImageCompressorException(ExceptionType::ARCHIVE_ENTRY_EXISTS);
+    }
+
+    if(validateImage(serializedImage.data(), serializedImage.size()) != ValidationResult::VALID)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    BarchImage image = deserializeImage(serializedImage.data(), serializedImage.size());
+
+    ArchiveEntry entry;
+    entry.name = name;
+    entry.offset = fileEnd;
+    entry.size = serializedImage.size();
+    entry.width = image.metadata.originalImageWidth;
+    entry.height = image.image.height;
+    entry.format = image.metadata.format;
+
+    // the image goes after the trailer, so the old index stays whole until the new one is written after the image
+    file.seekp(static_cast<std::streamoff>(fileEnd));
+    file.write(reinterpret_cast<const char*>(serializedImage.data()), serializedImage.size());
+
+    entries.push_back(entry);
+
+    try
+    {
+        writeIndex(fileEnd + serializedImage.size());
+    }
+    catch(const ImageCompressorException&)
+    {
+        entries.pop_back();
+        throw;
+    }
+}
+
+std::vector<BYTE> BarchArchive::extractSerialized(const std::string& name)
+{
+    const ArchiveEntry* entry = findEntry(name);
+
+    if(!entry)
+    {
+        throw ImageCompressorException(ExceptionType::ARCHIVE_ENTRY_NOT_FOUND);
+    }
+
+    std::vector<BYTE> data(static_cast<size_t>(entry->size));
+    file.seekg(static_cast<std::streamoff>(entry->offset));
+
+    if(!file.read(reinterpret_cast<char*>(data.data()), data.size()))
+    {
+        file.clear();
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+
+    return data;
+}
+
+BarchImage BarchArchive::extract(const std::string& name)
+{
+    std::vector<BYTE> data = extractSerialized(name);
+    return deserializeImage(data.data(), data.size());
+}
+
+void BarchArchive::readIndex()
+{
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    BYTE header[HEADER_SIZE];
+
+    file.seekg(0);
+
+    if(fileSize < HEADER_SIZE + TRAILER_SIZE || !file.read(reinterpret_cast<char*>(header), sizeof(header)))
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    uint32_t version = 0;
+    memcpy(&version, header + sizeof(ARCHIVE_MAGIC), sizeof(version));
+
+    if(memcmp(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || version != ARCHIVE_VERSION)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    fileEnd = fileSize;
+
+    if(readIndexAt(fileSize))
+    {
+        return;
+    }
+
+    // an append which didn't finish leaves a partial image or index after the last complete trailer, which is
+    // looked for from the end. New images go after the partial one
+    std::vector<BYTE> chunk(TRAILER_SEARCH_CHUNK + sizeof(INDEX_MAGIC) - 1);
+
+    for(uint64_t chunkEnd = fileSize; chunkEnd > HEADER_SIZE + TRAILER_SIZE - sizeof(INDEX_MAGIC);)
+    {
+        uint64_t chunkBegin = chunkEnd - HEADER_SIZE - TRAILER_SIZE > TRAILER_SEARCH_CHUNK ? chunkEnd - TRAILER_SEARCH_CHUNK
+                                                                                             : HEADER_SIZE + TRAILER_SIZE - sizeof(INDEX_MAGIC);
+        // chunks overlap by a magic less one byte, so a magic across two chunks is found too
+        uint64_t readEnd = chunkEnd + sizeof(INDEX_MAGIC) - 1 < fileSize ? chunkEnd + sizeof(INDEX_MAGIC) - 1 : fileSize;
+        size_t size = static_cast<size_t>(readEnd - chunkBegin);
+
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(chunkBegin));
+
+        if(!file.read(reinterpret_cast<char*>(chunk.data()), size))
+        {
+            break;
+        }
+
+        for(size_t position = size - sizeof(INDEX_MAGIC) + 1; position-- > 0;)
+        {
+            if(memcmp(chunk.data() + position, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+                    && readIndexAt(chunkBegin + position + sizeof(INDEX_MAGIC)))
+            {
+                return;
+            }
+        }
+
+        chunkEnd = chunkBegin;
+    }
+
+    file.clear();
+    throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+}
+
+bool BarchArchive::readIndexAt(uint64_t end)
+{
+    BYTE trailer[TRAILER_SIZE];
+    uint64_t offset = 0;
+
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(end - TRAILER_SIZE));
+
+    if(!file.read(reinterpret_cast<char*>(trailer), sizeof(trailer)) || memcmp(trailer + sizeof(uint64_t), INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+    {
+        return false;
+    }
+
+    memcpy(&offset, trailer, sizeof(offset));
+
+    if(offset < HEADER_SIZE || offset > end - TRAILER_SIZE)
+    {
+        return false;
+    }
+
+    std::vector<BYTE> index(static_cast<size_t>(end - TRAILER_SIZE - offset));
+    file.seekg(static_cast<std::streamoff>(offset));
+
+    if(!file.read(reinterpret_cast<char*>(index.data()), index.size()))
+    {
+        return false;
+    }
+
+    // the whole index must be entries within the data before it, anything else isn't a trailer of this archive
+    std::vector<ArchiveEntry> indexEntries;
+
+    try
+    {
+        Detail::ByteReader reader(index.data(), index.size());
+        uint32_t count = reader.read<uint32_t>();
+
+        for(uint32_t i = 0; i < count; ++i)
+        {
+            ArchiveEntry entry;
+            uint32_t nameSize = reader.read<uint32_t>();
+            const BYTE* name = reader.take(nameSize);
+            entry.name.assign(reinterpret_cast<const char*>(name), nameSize);
+            entry.offset = reader.read<uint64_t>();
+            entry.size = reader.read<uint64_t>();
+            entry.width = reader.read<int32_t>();
+            entry.height = reader.read<int32_t>();
+            entry.format = reader.read<int32_t>();
+
+            if(entry.offset < HEADER_SIZE || entry.offset > offset || entry.size > offset - entry.offset)
+            {
+                return false;
+            }
+
+            indexEntries.push_back(entry);
+        }
+
+        if(reader.remaining() != 0)
+        {
+            return false;
+        }
+    }
+    catch(const ImageCompressorException&)
+    {
+        return false;
+    }
+
+    entries = std::move(indexEntries);
+    indexOffset = offset;
+    return true;
+}
+
+void BarchArchive::writeIndex(uint64_t offset)
+{
+    std::vector<BYTE> index;
+    Detail::ByteWriter writer(index);
+
+    writer.write<uint32_t>(static_cast<uint32_t>(entries.size()));
+
+    for(const ArchiveEntry& entry : entries)
+    {
+        writer.write<uint32_t>(static_cast<uint32_t>(entry.name.size()));
+        writer.writeBytes(entry.name.data(), entry.name.size());
+        writer.write<uint64_t>(entry.offset);
+        writer.write<uint64_t>(entry.size);
+        writer.write<int32_t>(entry.width);
+        writer.write<int32_t>(entry.height);
+        writer.write<int32_t>(entry.format);
+    }
+
+    writer.write<uint64_t>(offset);
+    writer.writeBytes(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(reinterpret_cast<const char*>(index.data()), index.size());
+    file.flush();
+
+    if(!file)
+    {
+        // the old trailer is still the last complete one, the archive stays as it was
+        file.clear();
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+
+    indexOffset = offset;
+    fileEnd = offset + index.size();
+}
@@ -0,0 +1,73 @@
+#ifndef BARCHARCHIVE_H
+#define BARCHARCHIVE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "BarchFile.h"
+
+namespace ImageCompressor
+{
+    // Many .barch images packed into one file.
+    //
+    // Layout: header | data section | index | trailer
+    //   header  - "BARA" + uint32 version
+    //   data    - serialized .barch images (see serializeImage) one after another
+    //   index   - uint32 entries count, then per entry: uint32 name length, name,
+    //             uint64 offset, uint64 size, int32 width, int32 height, int32 format
+    //   trailer - uint64 index offset + "BAIX"
+    // Appending writes the new image after the trailer and a new index and trailer after it, so the old index
+    // stays whole until the new one is. The archive is read from the last complete trailer, an append which
+    // didn't finish is left out, and every append leaves the index before it behind as unused bytes.
+    // An entry can be read with one seek and one read (or mapped by offset and size).
+    struct ArchiveEntry
+    {
+        std::string name;
+        uint64_t offset = 0; // byte offset of the serialized image in the archive file
+        uint64_t size = 0; // size of the serialized image in bytes
+        int32_t width = 0; // image width in pixels
+        int32_t height = 0; // image height in pixels
+        int32_t format = 0; // pixel format of the source image
+    };
+
+    enum class ArchiveMode
+    {
+        READ = 0, // the archive must exist, it is never written
+        APPEND // an archive which doesn't exist yet is created
+    };
+
+    class BarchArchive
+    {
+    public:
+        // Opens an existing archive, or creates an empty one in APPEND mode. Throws FILE_ACCESS_ERROR if the file can't
+        // be opened in the mode, appending to an archive opened for reading throws it too.
+        explicit BarchArchive(const std::string& path, ArchiveMode mode = ArchiveMode::READ);
+
+        const std::vector<ArchiveEntry>& getEntries() const {return entries;}
+        const ArchiveEntry* findEntry(const std::string& name) const;
+
+        void append(const std::string& name, const BarchImage& image);
+        void appendSerialized(const std::string& name, const std::vector<BYTE>& serializedImage);
+
+        std::vector<BYTE> extractSerialized(const std::string& name);
+        BarchImage extract(const std::string& name);
+
+    private:
+        void readIndex();
+        // reads the index of the trailer which ends at end, false if there is no complete one
+        bool readIndexAt(uint64_t end);
+        void writeIndex(uint64_t offset);
+
+    private:
+        std::string path;
+        ArchiveMode mode;
+        std::fstream file;
+        std::vector<ArchiveEntry> entries;
+        uint64_t indexOffset;
+        uint64_t fileEnd; // where the next image is written
+    };
+};
+
+#endif // BARCHARCHIVE_H
@@ -0,0 +1,722 @@
+#include "BarchFile.h"
+#include "ByteStream.h"
+#include "Huffman.h"
+#include "TokenStream.h"
+
+#include <fstream>
+
+using namespace::ImageCompressor;
+
+namespace
+{
+const char FILE_MAGIC[4] = {'B', 'R', 'C', 'H'};
+const uint32_t FILE_VERSION = 2;
+
+bool isTag(const char* tag, const char* expected)
+{
+    return memcmp(tag, expected, 4) == 0;
+}
+
+bool isCriticalTag(const char* tag)
+{
+    return tag[0] >= 'A' && tag[0] <= 'Z';
+}
+
+// payload coding byte, prediction byte and code lengths; returns false if they are malformed
+bool readEntropyChunk(Detail::ByteReader& chunk, PayloadCoding& coding, bool& leftPrediction, const BYTE*& codeLengths)
+{
+    BYTE codingValue = chunk.read<BYTE>();
+    BYTE predictionValue = chunk.read<BYTE>();
+
+    if(codingValue > static_cast<BYTE>(PayloadCoding::HUFFMAN) || predictionValue > 1)
+    {
+        return false;
+    }
+
+    coding = static_cast<PayloadCoding>(codingValue);
+    leftPrediction = predictionValue != 0;
+    codeLengths = coding == PayloadCoding::HUFFMAN ? chunk.take(256) : nullptr;
+
+    return chunk.remaining() == 0;
+}
+
+// what serializeImage writes of an image, counted without its contents
+struct SerializedParts
+{
+    uint64_t colors = 0;
+    uint64_t rows = 0; // bits of ROWS
+    uint64_t dataBytes = 0;
+    bool entropy = false;
+    uint64_t codeLengths = 0;
+    uint64_t rowFilters = 0;
+    bool planar = false;
+    bool tiled = false;
+    uint64_t segmentOffsets = 0;
+    uint64_t rowIndex = 0; // hashes and offsets of rIDX
+    bool bands = false;
+    uint64_t bandCount = 0;
+};
+
+uint64_t serializedSize(const SerializedParts& parts)
+{
+    const uint64_t chunkHeader = 4 + sizeof(uint64_t);
+    uint64_t size = sizeof(FILE_MAGIC) + sizeof(uint32_t);
+
+    size += chunkHeader + 3 * sizeof(int32_t) + parts.colors * sizeof(uint32_t);
+    size += chunkHeader + 2 * sizeof(int32_t);
+    size += chunkHeader + (parts.rows + 7) / 8;
+    size += chunkHeader + parts.dataBytes;
+    size += parts.entropy ? chunkHeader + 2 + parts.codeLengths : 0;
+    size += parts.rowFilters > 0 ? chunkHeader + parts.rowFilters : 0;
+    size += parts.planar ? chunkHeader + 2 * sizeof(int32_t) : 0;
+    size += parts.tiled ? chunkHeader + 2 * sizeof(int32_t) : 0;
+    size += parts.segmentOffsets > 0 ? chunkHeader + parts.segmentOffsets * sizeof(uint64_t) : 0;
+    size += parts.rowIndex > 0 ? chunkHeader + parts.rowIndex * sizeof(uint64_t) : 0;
+    size += parts.bands ? chunkHeader + sizeof(int32_t) + parts.bandCount * (sizeof(uint64_t) + sizeof(uint32_t)) : 0;
+
+    return size;
+}
+
+// Files written before the chunked format: fixed sequence of int32 sizes and arrays.
+BarchImage deserializeLegacyImage(Detail::ByteReader& reader)
+{
+    BarchImage image;
+
+    image.metadata.format = reader.read<int32_t>();
+    image.metadata.originalImageWidth = reader.read<int32_t>();
+
+    int32_t count = reader.read<int32_t>();
+
+    if(count < 0 || static_cast<size_t>(count) > reader.remaining() / sizeof(uint32_t))
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    image.metadata.colorTable.resize(count);
+    reader.readBytes(image.metadata.colorTable.data(), count * sizeof(uint32_t));
+
+    image.image.width = reader.read<int32_t>();
+    image.image.height = reader.read<int32_t>();
+    count = reader.read<int32_t>();
+
+    if(count < 0 || static_cast<size_t>(count) > reader.remaining())
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    const BYTE* indexes = reader.take(count);
+    image.image.compressedIndexes.reserve(count);
+
+    for(int32_t i = 0; i < count; ++i)
+    {
+        image.image.compressedIndexes.push_back(indexes[i] != 0);
+    }
+
+    count = reader.read<int32_t>();
+
+    if(count < 0 || static_cast<size_t>(count) > reader.remaining())
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    const BYTE* bits = reader.take(count);
+    image.image.data.assign(bits, bits + count);
+
+    return image;
+}
+}
+
+std::vector<BYTE> ImageCompressor::serializeImage(const BarchImage& image)
+{
+    const ImageMetadata& metadata = image.metadata;
+    const CompressedImage& compressed = image.image;
+
+    SerializedParts parts;
+    parts.colors = metadata.colorTable.size();
+    parts.rows = compressed.compressedIndexes.size();
+    parts.dataBytes = compressed.data.size();
+    parts.entropy = compressed.payloadCoding != PayloadCoding::RAW || compressed.leftPrediction;
+    parts.codeLengths = compressed.codeLengths.size();
+    parts.rowFilters = compressed.rowFilters.size();
+    parts.planar = compressed.planarChannels != 0;
+    parts.tiled = compressed.tileWidth != 0;
+    parts.segmentOffsets = compressed.segmentOffsets.size();
+    parts.rowIndex = compressed.rowHashes.empty() ? 0 : compressed.rowHashes.size() + compressed.rowOffsets.size();
+    parts.bands = compressed.rowsPerBand > 0;
+    parts.bandCount = compressed.bands.size();
+
+    std::vector<BYTE> out;
+    out.reserve(static_cast<size_t>(serializedSize(parts)));
+
+    Detail::ByteWriter writer(out);
+
+    writer.writeBytes(FILE_MAGIC, sizeof(FILE_MAGIC));
+    writer.write<uint32_t>(FILE_VERSION);
+
+    size_t chunk = writer.beginChunk(CHUNK_METADATA);
+    writer.write<int32_t>(metadata.format);
+    writer.write<int32_t>(metadata.originalImageWidth);
+    writer.write<uint32_t>(static_cast<uint32_t>(metadata.colorTable.size()));
+    writer.writeBytes(metadata.colorTable.data(), metadata.colorTable.size() * sizeof(uint32_t));
+    writer.endChunk(chunk);
+
+    chunk = writer.beginChunk(CHUNK_HEADER);
+    writer.write<int32_t>(compressed.width);
+    writer.write<int32_t>(compressed.height);
+    writer.endChunk(chunk);
+
+    chunk = writer.beginChunk(CHUNK_ROWS);
+    BYTE flags = 0;
+
+    for(size_t i = 0; i < compressed.compressedIndexes.size(); ++i)
+    {
+        flags |= (compressed.compressedIndexes[i] ? 1 : 0) << (7 - i % 8);
+
+        if(i % 8 == 7 || i + 1 == compressed.compressedIndexes.size())
+        {
+            writer.write<BYTE>(flags);
+            flags = 0;
+        }
+    }
+
+    writer.endChunk(chunk);
+
+    chunk = writer.beginChunk(CHUNK_DATA);
+    writer.writeBytes(compressed.data.data(), compressed.data.size());
+    writer.endChunk(chunk);
+
+    if(compressed.payloadCoding != PayloadCoding::RAW || compressed.leftPrediction)
+    {
+        chunk = writer.beginChunk(CHUNK_ENTROPY);
+        writer.write<BYTE>(static_cast<BYTE>(compressed.payloadCoding));
+        writer.write<BYTE>(compressed.leftPrediction ? 1 : 0);
+        writer.writeBytes(compressed.codeLengths.data(), compressed.codeLengths.size());
+        writer.endChunk(chunk);
+    }
+
+    if(!compressed.rowFilters.empty())
+    {
+        chunk = writer.beginChunk(CHUNK_ROW_FILTERS);
+        writer.writeBytes(compressed.rowFilters.data(), compressed.rowFilters.size());
+        writer.endChunk(chunk);
+    }
+
+    if(compressed.planarChannels != 0)
+    {
+        chunk = writer.beginChunk(CHUNK_PLANES);
+        writer.write<int32_t>(compressed.planarChannels);
+        writer.write<int32_t>(compressed.pixelsPerRow);
+        writer.endChunk(chunk);
+    }
+
+    if(compressed.tileWidth != 0)
+    {
+        chunk = writer.beginChunk(CHUNK_TILES);
+        writer.write<int32_t>(compressed.tileWidth);
+        writer.write<int32_t>(compressed.tileHeight);
+        writer.endChunk(chunk);
+    }
+
+    if(!compressed.segmentOffsets.empty())
+    {
+        chunk = writer.beginChunk(CHUNK_SEGMENT_OFFSETS);
+        writer.writeBytes(compressed.segmentOffsets.data(), compressed.segmentOffsets.size() * sizeof(uint64_t));
+        writer.endChunk(chunk);
+    }
+
+    if(!compressed.rowHashes.empty())
+    {
+        chunk = writer.beginChunk(CHUNK_ROW_INDEX);
+        writer.writeBytes(compressed.rowHashes.data(), compressed.rowHashes.size() * sizeof(uint64_t));
+        writer.writeBytes(compressed.rowOffsets.data(), compressed.rowOffsets.size() * sizeof(uint64_t));
+        writer.endChunk(chunk);
+    }
+
+    if(compressed.rowsPerBand > 0)
+    {
+        chunk = writer.beginChunk(CHUNK_BANDS);
+        writer.write<int32_t>(compressed.rowsPerBand);
+
+        for(const BandInfo& band : compressed.bands)
+        {
+            writer.write<uint64_t>(band.bitOffset);
+            writer.write<uint32_t>(band.checksum);
+        }
+
+        writer.endChunk(chunk);
+    }
+
+    return out;
+}
+
+uint64_t ImageCompressor::estimateSerializedSize(const RawImageData& data, const CompressionOptions& options, const ImageMetadata& metadata)
+{
+    // estimateCompression checks the options against the image, the layout gives the sizes of the other chunks
+    CodecStats estimate = estimateCompression(data, options);
+    Detail::StoredLayout layout;
+    Detail::storedLayout(data.width, data.height, options.planarChannels, options.pixelsPerRow, options.tileWidth, options.tileHeight, layout);
+    int rowsPerBand = options.bandChecksums && options.rowsPerBand > 0 ? options.rowsPerBand : 0;
+
+    SerializedParts parts;
+    parts.colors = metadata.colorTable.size();
+    parts.rows = static_cast<uint64_t>(layout.rows);
+    parts.dataBytes = estimate.bytesOut;
+    parts.entropy = options.payloadCoding != PayloadCoding::RAW || options.leftPrediction;
+    parts.codeLengths = options.payloadCoding == PayloadCoding::HUFFMAN ? Detail::HUFFMAN_SYMBOLS : 0;
+    parts.rowFilters = options.rowFilters ? layout.rows : 0;
+    parts.planar = options.planarChannels != 0;
+    parts.tiled = options.tileWidth != 0;
+    parts.segmentOffsets = layout.segments > 1 ? layout.segments : 0;
+    parts.rowIndex = options.rowHashes ? 2 * static_cast<uint64_t>(layout.rows) + 1 : 0;
+    parts.bands = rowsPerBand > 0;
+    parts.bandCount = rowsPerBand ? (static_cast<uint64_t>(layout.rows) + rowsPerBand - 1) / rowsPerBand : 0;
+
+    return serializedSize(parts);
+}
+
+BarchImage ImageCompressor::deserializeImage(const BYTE* data, size_t size)
+{
+    Detail::ByteReader reader(data, size);
+
+    if(size < sizeof(FILE_MAGIC) || memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+    {
+        return deserializeLegacyImage(reader);
+    }
+
+    reader.take(sizeof(FILE_MAGIC));
+
+    if(reader.read<uint32_t>() != FILE_VERSION)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    BarchImage image;
+    bool hasMetadata = false;
+    bool hasHeader = false;
+    bool hasData = false;
+
+    // sizes of these chunks depend on the header, planes and tiles, so they are read after all chunks
+    Detail::ByteReader rows(nullptr, 0);
+    Detail::ByteReader filters(nullptr, 0);
+    Detail::ByteReader bands(nullptr, 0);
+    Detail::ByteReader offsets(nullptr, 0);
+    Detail::ByteReader rowIndex(nullptr, 0);
+    bool hasRows = false;
+    bool hasFilters = false;
+    bool hasBands = false;
+    bool hasOffsets = false;
+    bool hasRowIndex = false;
+
+    while(reader.remaining() > 0)
+    {
+        char tag[4];
+        Detail::ByteReader chunk = reader.readChunk(tag);
+
+        if(isTag(tag, CHUNK_METADATA))
+        {
+            image.metadata.format = chunk.read<int32_t>();
+            image.metadata.originalImageWidth = chunk.read<int32_t>();
+            uint32_t count = chunk.read<uint32_t>();
+
+            if(count > chunk.remaining() / sizeof(uint32_t))
+            {
+                throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+            }
+
+            image.metadata.colorTable.resize(count);
+            chunk.readBytes(image.metadata.colorTable.data(), count * sizeof(uint32_t));
+            hasMetadata = true;
+        }
+        else if(isTag(tag, CHUNK_HEADER))
+        {
+            image.image.width = chunk.read<int32_t>();
+            image.image.height = chunk.read<int32_t>();
+
+            if(image.image.width < 0 || image.image.height < 0)
+            {
+                throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+            }
+
+            hasHeader = true;
+        }
+        else if(isTag(tag, CHUNK_ROWS))
+        {
+            rows = chunk;
+            hasRows = true;
+        }
+        else if(isTag(tag, CHUNK_DATA))
+        {
+            size_t count = chunk.remaining();
+            const BYTE* bits = chunk.take(count);
+            image.image.data.assign(bits, bits + count);
+            hasData = true;
+        }
+        else if(isTag(tag, CHUNK_BANDS))
+        {
+            bands = chunk;
+            hasBands = true;
+        }
+        else if(isTag(tag, CHUNK_ENTROPY))
+        {
+            const BYTE* codeLengths = nullptr;
+
+            if(!readEntropyChunk(chunk, image.image.payloadCoding, image.image.leftPrediction, codeLengths))
+            {
+                throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+            }
+
+            if(codeLengths)
+            {
+                image.image.codeLengths.assign(codeLengths, codeLengths + 256);
+            }
+        }
+        else if(isTag(tag, CHUNK_ROW_FILTERS))
+        {
+            filters = chunk;
+            hasFilters = true;
+        }
+        else if(isTag(tag, CHUNK_PLANES))
+        {
+            image.image.planarChannels = chunk.read<int32_t>();
+            image.image.pixelsPerRow = chunk.read<int32_t>();
+        }
+        else if(isTag(tag, CHUNK_TILES))
+        {
+            image.image.tileWidth = chunk.read<int32_t>();
+            image.image.tileHeight = chunk.read<int32_t>();
+        }
+        else if(isTag(tag, CHUNK_SEGMENT_OFFSETS))
+        {
+            offsets = chunk;
+            hasOffsets = true;
+        }
+        else if(isTag(tag, CHUNK_ROW_INDEX))
+        {
+            rowIndex = chunk;
+            hasRowIndex = true;
+        }
+        else if(isCriticalTag(tag))
+        {
+            throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+        }
+    }
+
+    Detail::StoredLayout layout;
+
+    if(!hasMetadata || !hasHeader || !hasRows || !hasData
+            || !Detail::storedLayout(image.image.width, image.image.height, image.image.planarChannels, image.image.pixelsPerRow,
+                                     image.image.tileWidth, image.image.tileHeight, layout))
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+    }
+
+    size_t storedRows = static_cast<size_t>(layout.rows);
+    const BYTE* flags = rows.take((storedRows + 7) / 8);
+    image.image.compressedIndexes.resize(storedRows);
+
+    for(size_t i = 0; i < storedRows; ++i)
+    {
+        image.image.compressedIndexes[i] = (flags[i / 8] >> (7 - i % 8)) & 0x01;
+    }
+
+    if(hasFilters)
+    {
+        const BYTE* rowFilters = filters.take(storedRows);
+        image.image.rowFilters.assign(rowFilters, rowFilters + storedRows);
+    }
+
+    if(hasOffsets)
+    {
+        if(offsets.remaining() != static_cast<size_t>(layout.segments) * sizeof(uint64_t))
+        {
+            throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+        }
+
+        image.image.segmentOffsets.resize(layout.segments);
+        offsets.readBytes(image.image.segmentOffsets.data(), offsets.remaining());
+    }
+
+    if(hasRowIndex)
+    {
+        if(rowIndex.remaining() != (2 * storedRows + 1) * sizeof(uint64_t))
+        {
+            throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+        }
+
+        image.image.rowHashes.resize(storedRows);
+        image.image.rowOffsets.resize(storedRows + 1);
+        rowIndex.readBytes(image.image.rowHashes.data(), storedRows * sizeof(uint64_t));
+        rowIndex.readBytes(image.image.rowOffsets.data(), (storedRows + 1) * sizeof(uint64_t));
+    }
+
+    if(hasBands)
+    {
+        int32_t rowsPerBand = bands.read<int32_t>();
+        size_t bandsCount = rowsPerBand > 0 ? (storedRows + rowsPerBand - 1) / rowsPerBand : 0;
+
+        if(rowsPerBand <= 0 || bandsCount > bands.remaining() / (sizeof(uint64_t) + sizeof(uint32_t)))
+        {
+            throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+        }
+
+        image.image.rowsPerBand = rowsPerBand;
+        image.image.bands.resize(bandsCount);
+
+        for(BandInfo& band : image.image.bands)
+        {
+            band.bitOffset = bands.read<uint64_t>();
+            band.checksum = bands.read<uint32_t>();
+        }
+    }
+
+    return image;
+}
+
+ValidationResult ImageCompressor::validateImage(const BYTE* data, size_t size, uint64_t maxDecompressedSize)
+{
+    Detail::TokenStreamView view;
+    int32_t width = 0;
+    int32_t height = 0;
+
+    try
+    {
+        Detail::ByteReader reader(data, size);
+
+        if(size < sizeof(FILE_MAGIC) || memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+        {
+            reader.take(2 * sizeof(int32_t));
+            int32_t count = reader.read<int32_t>();
+
+            if(count < 0)
+            {
+                return ValidationResult::BAD_HEADER;
+            }
+
+            reader.take(static_cast<size_t>(count) * sizeof(uint32_t));
+            width = reader.read<int32_t>();
+            height = reader.read<int32_t>();
+
+            if(!Detail::storedLayout(width, height, 0, 0, 0, 0, view.layout) || reader.read<int32_t>() != height)
+            {
+                return ValidationResult::BAD_HEADER;
+            }
+
+            view.rowFlags = reader.take(height);
+            count = reader.read<int32_t>();
+
+            if(count < 0 || static_cast<size_t>(count) != reader.remaining())
+            {
+                return ValidationResult::BAD_HEADER;
+            }
+
+            view.size = count;
+            view.data = reader.take(count);
+        }
+        else
+        {
+            reader.take(sizeof(FILE_MAGIC));
+
+            if(reader.read<uint32_t>() != FILE_VERSION)
+            {
+                return ValidationResult::BAD_HEADER;
+            }
+
+            bool hasMetadata = false;
+            bool hasHeader = false;
+            bool hasData = false;
+            size_t rowFlagsSize = 0;
+            size_t rowFiltersSize = 0;
+            size_t bandsSize = 0;
+            int32_t planarChannels = 0;
+            int32_t pixelsPerRow = 0;
+            int32_t tileWidth = 0;
+            int32_t tileHeight = 0;
+            size_t segmentOffsetsSize = 0;
+            size_t rowIndexSize = 0;
+
+            while(reader.remaining() > 0)
+            {
+                char tag[4];
+                Detail::ByteReader chunk = reader.readChunk(tag);
+
+                if(isTag(tag, CHUNK_METADATA))
+                {
+                    chunk.take(2 * sizeof(int32_t));
+
+                    if(chunk.read<uint32_t>() != chunk.remaining() / sizeof(uint32_t) || chunk.remaining() % sizeof(uint32_t) != 0)
+                    {
+                        return ValidationResult::BAD_HEADER;
+                    }
+
+                    hasMetadata = true;
+                }
+                else if(isTag(tag, CHUNK_HEADER))
+                {
+                    width = chunk.read<int32_t>();
+                    height = chunk.read<int32_t>();
+                    hasHeader = true;
+                }
+                else if(isTag(tag, CHUNK_ROWS))
+                {
+                    view.packedRowFlags = true;
+                    rowFlagsSize = chunk.remaining();
+                    view.rowFlags = chunk.take(rowFlagsSize);
+                }
+                else if(isTag(tag, CHUNK_DATA))
+                {
+                    view.size = chunk.remaining();
+                    view.data = chunk.take(view.size);
+                    hasData = true;
+                }
+                else if(isTag(tag, CHUNK_BANDS))
+                {
+                    view.rowsPerBand = chunk.read<int32_t>();
+                    bandsSize = chunk.remaining();
+                    view.bands = chunk.take(bandsSize);
+                }
+                else if(isTag(tag, CHUNK_ENTROPY))
+                {
+                    bool leftPrediction = false;
+
+                    if(!readEntropyChunk(chunk, view.payloadCoding, leftPrediction, view.codeLengths))
+                    {
+                        return ValidationResult::BAD_HEADER;
+                    }
+                }
+                else if(isTag(tag, CHUNK_ROW_FILTERS))
+                {
+                    rowFiltersSize = chunk.remaining();
+                    view.rowFilters = chunk.take(rowFiltersSize);
+                }
+                else if(isTag(tag, CHUNK_PLANES))
+                {
+                    planarChannels = chunk.read<int32_t>();
+                    pixelsPerRow = chunk.read<int32_t>();
+                }
+                else if(isTag(tag, CHUNK_TILES))
+                {
+                    tileWidth = chunk.read<int32_t>();
+                    tileHeight = chunk.read<int32_t>();
+                }
+                else if(isTag(tag, CHUNK_SEGMENT_OFFSETS))
+                {
+                    segmentOffsetsSize = chunk.remaining();
+                    view.segmentOffsets = chunk.take(segmentOffsetsSize);
+                }
+                else if(isTag(tag, CHUNK_ROW_INDEX))
+                {
+                    // hashes aren't checked, only the row offsets which follow them
+                    rowIndexSize = chunk.remaining();
+                    view.rowOffsets = chunk.take(rowIndexSize);
+                }
+                else if(isCriticalTag(tag))
+                {
+                    return ValidationResult::BAD_HEADER;
+                }
+            }
+
+            if(!hasMetadata || !hasHeader || !hasData || !view.rowFlags
+                    || !Detail::storedLayout(width, height, planarChannels, pixelsPerRow, tileWidth, tileHeight, view.layout))
+            {
+                return ValidationResult::BAD_HEADER;
+            }
+
+            size_t rows = static_cast<size_t>(view.layout.rows);
+
+            if(rowFlagsSize != (rows + 7) / 8
+                    || (view.segmentOffsets && segmentOffsetsSize != static_cast<size_t>(view.layout.segments) * sizeof(uint64_t))
+                    || (view.rowFilters && rowFiltersSize != rows)
+                    || (view.rowOffsets && rowIndexSize != (2 * rows + 1) * sizeof(uint64_t)))
+            {
+                return ValidationResult::BAD_HEADER;
+            }
+
+            if(view.rowOffsets)
+            {
+                view.rowOffsets += rows * sizeof(uint64_t);
+            }
+
+            if(view.bands)
+            {
+                size_t bandsCount = view.rowsPerBand > 0 ? (rows + view.rowsPerBand - 1) / view.rowsPerBand : 0;
+
+                if(view.rowsPerBand <= 0 || bandsSize != bandsCount * (sizeof(uint64_t) + sizeof(uint32_t)))
+                {
+                    return ValidationResult::BAD_BANDS;
+                }
+            }
+        }
+    }
+    catch(const ImageCompressorException&)
+    {
+        return ValidationResult::BAD_HEADER;
+    }
+
+    if(static_cast<uint64_t>(width) * static_cast<uint64_t>(height) > maxDecompressedSize)
+    {
+        return ValidationResult::TOO_LARGE;
+    }
+
+    return Detail::checkTokenStream(view) ? ValidationResult::VALID : ValidationResult::BAD_TOKEN_STREAM;
+}
+
+const char* ImageCompressor::validationResultToString(ValidationResult result)
+{
+    switch(result)
+    {
+    case ValidationResult::VALID:
+        return "valid";
+    case ValidationResult::BAD_HEADER:
+        return "malformed header or chunks";
+    case ValidationResult::TOO_LARGE:
+        return "image is too large";
+    case ValidationResult::BAD_BANDS:
+        return "band table doesn't match the image";
+    case ValidationResult::BAD_TOKEN_STREAM:
+        return "compressed data doesn't match the image size";
+    }
+
+    return "unknown";
+}
+
+void ImageCompressor::saveImageToFile(const std::string& path, const BarchImage& image)
+{
+    writeWholeFile(path, serializeImage(image));
+}
+
+BarchImage ImageCompressor::loadImageFromFile(const std::string& path)
+{
+    std::vector<BYTE> data = readWholeFile(path);
+    return deserializeImage(data.data(), data.size());
+}
+
+std::vector<BYTE> ImageCompressor::readWholeFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if(!file.is_open())
+    {
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+
+    std::streamoff size = file.tellg();
+    std::vector<BYTE> data(static_cast<size_t>(size));
+    file.seekg(0);
+
+    if(!file.read(reinterpret_cast<char*>(data.data()), size))
+    {
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+
+    return data;
+}
+
+void ImageCompressor::writeWholeFile(const std::string& path, const std::vector<BYTE>& data)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if(!file.is_open() || !file.write(reinterpret_cast<const char*>(data.data()), data.size()))
+    {
+        throw ImageCompressorException(ExceptionType::FILE_ACCESS_ERROR);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef BARCHFILE_H
+#define BARCHFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ImageCompressor.h"
+
+namespace ImageCompressor
+{
+    // Data needed to rebuild the source image around the decompressed bytes.
+    struct ImageMetadata
+    {
+        int32_t format = 0; // pixel format of the source image (QImage::Format in the app)
+        int32_t originalImageWidth = 0; // width in pixels, CompressedImage::width is bytes per line
+        std::vector<uint32_t> colorTable;
+    };
+
+    // Content of a single .barch file.
+    struct BarchImage
+    {
+        ImageMetadata metadata;
+        CompressedImage image;
+    };
+
+    // .barch file is "BRCH" + uint32 version followed by chunks: 4 character tag, uint64 payload length, payload.
+    //   META - int32 format, int32 original image width, uint32 color table size, color table
+    //   HEAD - int32 width, int32 height
+    //   ROWS - one bit per row, set for rows which are entirely white
+    //   DATA - compressed bit stream
+    //   BAND - optional, int32 rows per band, then uint64 bit offset and uint32 CRC32C per band
+    //   ENTR - optional, uint8 payload coding, uint8 left prediction, 256 Huffman code lengths for HUFFMAN
+    //   FILT - optional, filter of every row, one byte per row
+    //   PLAN - optional, int32 planar channels, int32 pixels per row
+    //   TILE - optional, int32 tile width, int32 tile height
+    //   OFFS - optional, uint64 bit offset of every tile of every plane
+    //   rIDX - optional, uint64 XXH64 of every stored row, then uint64 bit offset of every stored row and of the end
+    // ROWS, FILT and BAND cover every stored row, see CompressedImage.
+    // Unknown chunks with a lowercase first letter are skipped, unknown uppercase ones can't be
+    // ignored and make the file unreadable. Files without the magic are read in the older fixed layout.
+    const char CHUNK_METADATA[] = "META";
+    const char CHUNK_HEADER[] = "HEAD";
+    const char CHUNK_ROWS[] = "ROWS";
+    const char CHUNK_DATA[] = "DATA";
+    const char CHUNK_BANDS[] = "BAND";
+    const char CHUNK_ENTROPY[] = "ENTR";
+    const char CHUNK_ROW_FILTERS[] = "FILT";
+    const char CHUNK_PLANES[] = "PLAN";
+    const char CHUNK_TILES[] = "TILE";
+    const char CHUNK_SEGMENT_OFFSETS[] = "OFFS";
+    const char CHUNK_ROW_INDEX[] = "rIDX";
+
+    std::vector<BYTE> serializeImage(const BarchImage& image);
+    // Size of the file serializeImage would give for data compressed with options, counted with estimateCompression
+    // without compressing. Adds every chunk the options bring besides the stream, e.g. 16 bytes a row of rIDX with row
+    // hashes and 12 a band with band checksums, so an image whose file wouldn't be smaller can be left as it is.
+    uint64_t estimateSerializedSize(const RawImageData& data, const CompressionOptions& options, const ImageMetadata& metadata);
+    BarchImage deserializeImage(const BYTE* data, size_t size);
+
+    enum class ValidationResult
+    {
+        VALID = 0,
+        BAD_HEADER, // unknown magic or version, missing or malformed chunk, sizes past the end of data
+        TOO_LARGE, // decompressed image would be bigger than the allowed size
+        BAD_BANDS, // band table doesn't match the image height
+        BAD_TOKEN_STREAM // tokens don't cover exactly width * height bytes or band, segment or row offsets are wrong
+    };
+
+    // Structural check of a serialized .barch image which runs in linear time and allocates nothing,
+    // so corrupt input is rejected before any memory is reserved for it. Checksums are not verified.
+    ValidationResult validateImage(const BYTE* data, size_t size, uint64_t maxDecompressedSize = UINT64_MAX);
+    const char* validationResultToString(ValidationResult result);
+
+    void saveImageToFile(const std::string& path, const BarchImage& image);
+    BarchImage loadImageFromFile(const std::string& path);
+
+    std::vector<BYTE> readWholeFile(const std::string& path);
+    void writeWholeFile(const std::string& path, const std::vector<BYTE>& data);
+};
+
+#endif // BARCHFILE_H
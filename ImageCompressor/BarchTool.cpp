@@ -0,0 +1,105 @@
+#include <iostream>
+#include <string>
+
+#include "BarchArchive.h"
+
+// Command line access to .barch archives:
+//   barch list <archive>
+//   barch append <archive> <image.barch>...
+//   barch extract <archive> <name> [<output.barch>]
+//   barch validate <archive>
+
+namespace
+{
+int printUsage()
+{
+    std::cerr << "Usage:\n"
+              << "  barch list <archive>\n"
+              << "  barch append <archive> <image.barch>...\n"
+              << "  barch extract <archive> <name> [<output.barch>]\n"
+              << "  barch validate <archive>\n";
+    return 2;
+}
+
+std::string entryNameFromPath(const std::string& path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        return printUsage();
+    }
+
+    std::string command = argv[1];
+
+    try
+    {
+        // only append may create the archive, the other commands fail on a path which isn't one
+        ImageCompressor::ArchiveMode mode = command == "append" ? ImageCompressor::ArchiveMode::APPEND : ImageCompressor::ArchiveMode::READ;
+        ImageCompressor::BarchArchive archive(argv[2], mode);
+
+        if(command == "list")
+        {
+            for(const ImageCompressor::ArchiveEntry& entry : archive.getEntries())
+            {
+                std::cout << entry.name << '\t' << entry.width << 'x' << entry.height
+                          << "\tformat " << entry.format << '\t' << entry.size << " bytes at " << entry.offset << '\n';
+            }
+        }
+        else if(command == "append" && argc >= 4)
+        {
+            for(int i = 3; i < argc; ++i)
+            {
+                archive.appendSerialized(entryNameFromPath(argv[i]), ImageCompressor::readWholeFile(argv[i]));
+            }
+        }
+        else if(command == "extract" && argc >= 4)
+        {
+            std::string name = argv[3];
+            // names come from the archive, so without an output path only the file name is used, in the current directory
+            std::string output = argc >= 5 ? argv[4] : entryNameFromPath(name);
+
+            if(output.empty() || output == "." || output == ".." || output.find(':') != std::string::npos)
+            {
+                std::cerr << "Entry name can't be used as a file name, give an output path: " << name << '\n';
+                return 1;
+            }
+
+            ImageCompressor::writeWholeFile(output, archive.extractSerialized(name));
+        }
+        else if(command == "validate")
+        {
+            int invalidEntries = 0;
+
+            for(const ImageCompressor::ArchiveEntry& entry : archive.getEntries())
+            {
+                std::vector<ImageCompressor::BYTE> data = archive.extractSerialized(entry.name);
+                ImageCompressor::ValidationResult result = ImageCompressor::validateImage(data.data(), data.size());
+
+                if(result != ImageCompressor::ValidationResult::VALID)
+                {
+                    std::cout << entry.name << '\t' << ImageCompressor::validationResultToString(result) << '\n';
+                    ++invalidEntries;
+                }
+            }
+
+            return invalidEntries == 0 ? 0 : 1;
+        }
+        else
+        {
+            return printUsage();
+        }
+    }
+    catch(const ImageCompressor::ImageCompressorException& e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
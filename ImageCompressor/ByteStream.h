@@ -0,0 +1,123 @@
+#ifndef BYTESTREAM_H
+#define BYTESTREAM_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ImageCompressor.h"
+
+// Internal helpers for the .barch containers. Values are stored in host byte order,
+// as the original .barch writer in the app did.
+namespace ImageCompressor
+{
+namespace Detail
+{
+    class ByteWriter
+    {
+    public:
+        explicit ByteWriter(std::vector<BYTE>& out) : out{out} {}
+
+        template<typename T>
+        void write(T value)
+        {
+            writeBytes(&value, sizeof(T));
+        }
+
+        void writeBytes(const void* begin, size_t size)
+        {
+            const BYTE* bytes = static_cast<const BYTE*>(begin);
+            out.insert(out.end(), bytes, bytes + size);
+        }
+
+        template<typename T>
+        void patch(size_t position, T value)
+        {
+            memcpy(out.data() + position, &value, sizeof(T));
+        }
+
+        // Chunk is a 4 character tag, uint64 payload length and the payload.
+        size_t beginChunk(const char* tag)
+        {
+            writeBytes(tag, 4);
+            write<uint64_t>(0);
+            return out.size();
+        }
+
+        void endChunk(size_t payloadStart)
+        {
+            patch<uint64_t>(payloadStart - sizeof(uint64_t), out.size() - payloadStart);
+        }
+
+        size_t size() const {return out.size();}
+
+    private:
+        std::vector<BYTE>& out;
+    };
+
+    // Bounds-checked reader. Every read past the end throws INCORRECT_FILE_DATA,
+    // so sizes taken from a file must be checked with remaining() before reserving memory.
+    class ByteReader
+    {
+    public:
+        ByteReader(const BYTE* data, size_t size) : data{data}, size{size}, position{0} {}
+
+        template<typename T>
+        T read()
+        {
+            T value;
+            readBytes(&value, sizeof(T));
+            return value;
+        }
+
+        void readBytes(void* dest, size_t count)
+        {
+            // dest of nothing may be null, e.g. data() of an empty color table, which memcpy doesn't allow
+            if(count == 0)
+            {
+                return;
+            }
+
+            const BYTE* source = take(count);
+            memcpy(dest, source, count);
+        }
+
+        const BYTE* take(size_t count)
+        {
+            if(count > remaining())
+            {
+                throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+            }
+
+            const BYTE* begin = data + position;
+            position += count;
+            return begin;
+        }
+
+        // Reads the next chunk header and returns a reader over its payload.
+        ByteReader readChunk(char* tag)
+        {
+            readBytes(tag, 4);
+            uint64_t length = read<uint64_t>();
+
+            if(length > remaining())
+            {
+                throw ImageCompressorException(ExceptionType::INCORRECT_FILE_DATA);
+            }
+
+            return ByteReader(take(static_cast<size_t>(length)), static_cast<size_t>(length));
+        }
+
+        size_t remaining() const {return size - position;}
+        size_t tell() const {return position;}
+
+    private:
+        const BYTE* data;
+        size_t size;
+        size_t position;
+    };
+}
+};
+
+#endif // BYTESTREAM_H
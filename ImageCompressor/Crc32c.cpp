@@ -0,0 +1,142 @@
+#include "Crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMAGECOMPRESSOR_CRC32C_X86
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace
+{
+const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78; // reflected 0x1EDC6F41
+
+struct SlicingTables
+{
+    uint32_t table[8][256];
+
+    SlicingTables()
+    {
+        for(uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+
+            for(int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1)));
+            }
+
+            table[0][i] = crc;
+        }
+
+        for(uint32_t i = 0; i < 256; ++i)
+        {
+            for(int slice = 1; slice < 8; ++slice)
+            {
+                table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+uint32_t crc32cSlicingBy8(uint32_t crc, const unsigned char* data, size_t size)
+{
+    static const SlicingTables tables;
+    const uint32_t (&t)[8][256] = tables.table;
+
+    while(size >= 8)
+    {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, data, 4);
+        memcpy(&high, data + 4, 4);
+        low ^= crc;
+
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+            ^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while(size > 0)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+        ++data;
+        --size;
+    }
+
+    return crc;
+}
+
+#ifdef IMAGECOMPRESSOR_CRC32C_X86
+#if defined(__GNUC__)
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, size_t size)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+
+    while(size >= 8)
+    {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        size -= 8;
+    }
+
+    crc = static_cast<uint32_t>(crc64);
+#endif
+
+    while(size >= 4)
+    {
+        uint32_t value;
+        memcpy(&value, data, 4);
+        crc = _mm_crc32_u32(crc, value);
+        data += 4;
+        size -= 4;
+    }
+
+    while(size > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+        ++data;
+        --size;
+    }
+
+    return crc;
+}
+
+bool hasHardwareCrc32c()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+}
+
+uint32_t ImageCompressor::crc32c(const unsigned char* data, size_t size, uint32_t crc)
+{
+    crc = ~crc;
+
+#ifdef IMAGECOMPRESSOR_CRC32C_X86
+    static const bool hardware = hasHardwareCrc32c();
+
+    if(hardware)
+    {
+        return ~crc32cHardware(crc, data, size);
+    }
+#endif
+
+    return ~crc32cSlicingBy8(crc, data, size);
+}
@@ -0,0 +1,15 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageCompressor
+{
+    // CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it
+    // and a slicing-by-8 table implementation otherwise.
+    // Pass the previous result as crc to continue a checksum over several buffers.
+    uint32_t crc32c(const unsigned char* data, size_t size, uint32_t crc = 0);
+};
+
+#endif // CRC32C_H
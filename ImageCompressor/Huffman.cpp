@@ -0,0 +1,149 @@
+#include "Huffman.h"
+
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+using namespace::ImageCompressor;
+
+namespace
+{
+// Depth of every leaf of the Huffman tree built for the weights.
+int treeDepths(const uint64_t (&weights)[Detail::HUFFMAN_SYMBOLS], BYTE (&depths)[Detail::HUFFMAN_SYMBOLS])
+{
+    using Node = std::pair<uint64_t, int>;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+    int parent[2 * Detail::HUFFMAN_SYMBOLS];
+    int nodes = Detail::HUFFMAN_SYMBOLS;
+
+    for(int symbol = 0; symbol < Detail::HUFFMAN_SYMBOLS; ++symbol)
+    {
+        queue.push(Node(weights[symbol], symbol));
+    }
+
+    while(queue.size() > 1)
+    {
+        Node first = queue.top();
+        queue.pop();
+        Node second = queue.top();
+        queue.pop();
+
+        parent[first.second] = nodes;
+        parent[second.second] = nodes;
+        queue.push(Node(first.first + second.first, nodes));
+        ++nodes;
+    }
+
+    int root = nodes - 1;
+    int maxDepth = 0;
+
+    for(int symbol = 0; symbol < Detail::HUFFMAN_SYMBOLS; ++symbol)
+    {
+        int depth = 0;
+
+        for(int node = symbol; node != root; node = parent[node])
+        {
+            ++depth;
+        }
+
+        depths[symbol] = static_cast<BYTE>(depth);
+        maxDepth = depth > maxDepth ? depth : maxDepth;
+    }
+
+    return maxDepth;
+}
+}
+
+void ImageCompressor::Detail::buildHuffmanCodeLengths(const uint64_t (&frequencies)[HUFFMAN_SYMBOLS], BYTE (&lengths)[HUFFMAN_SYMBOLS])
+{
+    uint64_t weights[HUFFMAN_SYMBOLS];
+
+    for(int symbol = 0; symbol < HUFFMAN_SYMBOLS; ++symbol)
+    {
+        weights[symbol] = frequencies[symbol] + 1;
+    }
+
+    // flattening the weights until the longest code fits into the decode table
+    while(treeDepths(weights, lengths) > HUFFMAN_MAX_CODE_LENGTH)
+    {
+        for(uint64_t& weight : weights)
+        {
+            weight = (weight >> 1) | 1;
+        }
+    }
+}
+
+bool ImageCompressor::Detail::buildHuffmanCodes(const BYTE (&lengths)[HUFFMAN_SYMBOLS], uint16_t (&codes)[HUFFMAN_SYMBOLS])
+{
+    int lengthCounts[HUFFMAN_MAX_CODE_LENGTH + 1] = {};
+    uint32_t kraftSum = 0;
+
+    for(int symbol = 0; symbol < HUFFMAN_SYMBOLS; ++symbol)
+    {
+        if(lengths[symbol] > HUFFMAN_MAX_CODE_LENGTH)
+        {
+            return false;
+        }
+
+        if(lengths[symbol] > 0)
+        {
+            ++lengthCounts[lengths[symbol]];
+            kraftSum += 1u << (HUFFMAN_MAX_CODE_LENGTH - lengths[symbol]);
+        }
+    }
+
+    if(kraftSum > (1u << HUFFMAN_MAX_CODE_LENGTH))
+    {
+        return false;
+    }
+
+    uint32_t nextCode[HUFFMAN_MAX_CODE_LENGTH + 1] = {};
+    uint32_t code = 0;
+
+    for(int length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; ++length)
+    {
+        code = (code + lengthCounts[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+
+    for(int symbol = 0; symbol < HUFFMAN_SYMBOLS; ++symbol)
+    {
+        codes[symbol] = lengths[symbol] > 0 ? static_cast<uint16_t>(nextCode[lengths[symbol]]++) : 0;
+    }
+
+    return true;
+}
+
+bool ImageCompressor::Detail::HuffmanDecodeTable::build(const BYTE* lengths)
+{
+    BYTE codeLengths[HUFFMAN_SYMBOLS];
+    uint16_t codes[HUFFMAN_SYMBOLS];
+    memcpy(codeLengths, lengths, sizeof(codeLengths));
+
+    if(!buildHuffmanCodes(codeLengths, codes))
+    {
+        return false;
+    }
+
+    memset(entries, 0, sizeof(entries));
+
+    for(int symbol = 0; symbol < HUFFMAN_SYMBOLS; ++symbol)
+    {
+        int length = codeLengths[symbol];
+
+        if(length > 0)
+        {
+            uint32_t first = static_cast<uint32_t>(codes[symbol]) << (HUFFMAN_MAX_CODE_LENGTH - length);
+            uint32_t last = first + (1u << (HUFFMAN_MAX_CODE_LENGTH - length));
+
+            for(uint32_t entry = first; entry < last; ++entry)
+            {
+                entries[entry] = static_cast<uint16_t>(symbol | length << 8);
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <cstdint>
+
+#include "ImageCompressor.h"
+
+// Internal canonical Huffman code over byte symbols, used for DIFFERENT payloads.
+namespace ImageCompressor
+{
+namespace Detail
+{
+    const int HUFFMAN_SYMBOLS = 256;
+    const int HUFFMAN_MAX_CODE_LENGTH = 12; // codes are decoded with one lookup in a 2^12 entries table
+
+    // Every symbol gets a code, even the ones with zero frequency, so any byte can be encoded later
+    // with the same table.
+    void buildHuffmanCodeLengths(const uint64_t (&frequencies)[HUFFMAN_SYMBOLS], BYTE (&lengths)[HUFFMAN_SYMBOLS]);
+
+    // Canonical codes for the lengths, returns false if the lengths don't form a prefix code.
+    bool buildHuffmanCodes(const BYTE (&lengths)[HUFFMAN_SYMBOLS], uint16_t (&codes)[HUFFMAN_SYMBOLS]);
+
+    class HuffmanDecodeTable
+    {
+    public:
+        // Returns false if the lengths don't form a prefix code.
+        bool build(const BYTE* lengths);
+
+        // Takes the next HUFFMAN_MAX_CODE_LENGTH bits of the stream, returns symbol | length << 8,
+        // length is 0 for bit patterns which are not a code.
+        uint16_t lookup(uint32_t bits) const {return entries[bits];}
+
+    private:
+        uint16_t entries[1 << HUFFMAN_MAX_CODE_LENGTH];
+    };
+}
+};
+
+#endif // HUFFMAN_H
@@ -1,9 +1,49 @@
 #include "ImageCompressor.h"
 
+#include "Crc32c.h"
+#include "Huffman.h"
+#include "Planar.h"
+#include "RowFilters.h"
+#include "TokenStream.h"
+#include "Trace.h"
+#include "XxHash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// SSE2 is part of every x86-64 CPU, so groups are classified with it without a runtime check
+#if defined(__x86_64__) || defined(_M_X64)
+#define IMAGECOMPRESSOR_GROUPS_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace::ImageCompressor;
 
+// counters of CodecStats are only kept in builds with IMAGECOMPRESSOR_STATS. IMAGECOMPRESSOR_COUNT takes a pointer which
+// may be null, IMAGECOMPRESSOR_ADD the CodecStats itself.
+#ifdef IMAGECOMPRESSOR_STATS
+#define IMAGECOMPRESSOR_COUNT(stats, counter, value) do { if(stats) { (stats)->counter += (value); } } while(false)
+#define IMAGECOMPRESSOR_ADD(stats, counter, value) do { (stats).counter += (value); } while(false)
+#else
+#define IMAGECOMPRESSOR_COUNT(stats, counter, value) do {} while(false)
+#define IMAGECOMPRESSOR_ADD(stats, counter, value) do {} while(false)
+#endif
+
 namespace
 {
+#ifdef IMAGECOMPRESSOR_STATS
+const bool COUNTING_STATS = true;
+#else
+const bool COUNTING_STATS = false;
+#endif
+
 enum class PixelColor
 {
     WHITE = 0xff,
@@ -21,105 +61,313 @@ enum class DataIdentifiers
 class BinaryWriter
 {
 public:
-    BinaryWriter(): currentWriteIndex{7} {}
+    BinaryWriter(): bitBuffer{0}, bufferedBits{0}, allocationCount{0} {}
+
+    // writes numOfBits (up to 32) lowest bits of value, most significant first
+    void writeBits(uint32_t value, int numOfBits)
+    {
+        bitBuffer = (bitBuffer << numOfBits) | (value & ((1ull << numOfBits) - 1));
+        bufferedBits += numOfBits;
+
+        while(bufferedBits >= 8)
+        {
+            bufferedBits -= 8;
+            countGrowth(1);
+            data.push_back(static_cast<BYTE>(bitBuffer >> bufferedBits));
+        }
+    }
+
+    // writes first numOfBits bits of the bytes starting from begin
     void writeData(const BYTE*begin, int numOfBits)
     {
         if(begin)
         {
-            int bitToCopy = 7;
-            while(numOfBits > 0)
+            for(; numOfBits >= 8; numOfBits -= 8)
             {
-                if(currentWriteIndex == 7)
-                {
-                    data.push_back(0x00);
-                }
+                writeBits(*begin++, 8);
+            }
+
+            if(numOfBits > 0)
+            {
+                writeBits(*begin >> (8 - numOfBits), numOfBits);
+            }
+        }
+    }
 
-                data.back() |= ((*begin >> bitToCopy) & 0x01) << currentWriteIndex;
+    // returns written data, last byte is padded with zero bits
+    std::vector<BYTE> takeData()
+    {
+        if(bufferedBits > 0)
+        {
+            writeBits(0, 8 - bufferedBits);
+        }
 
-                --bitToCopy;
-                --currentWriteIndex;
-                --numOfBits;
+        return std::move(data);
+    }
 
-                if(currentWriteIndex < 0)
-                {
-                    currentWriteIndex = 7;
-                }
+    uint64_t bitCount() const
+    {
+        return data.size() * 8 + bufferedBits;
+    }
 
-                if(bitToCopy < 0)
-                {
-                    ++begin;
-                    bitToCopy = 7;
-                }
+    // makes room for numOfBits bits in total, so writing up to them doesn't move the data
+    void reserveBits(uint64_t numOfBits)
+    {
+        size_t bytes = static_cast<size_t>((numOfBits + 7) / 8);
+        countGrowth(bytes > data.size() ? bytes - data.size() : 0);
+        data.reserve(bytes);
+    }
+
+    // appends everything written to other, other is left empty
+    void append(BinaryWriter& other)
+    {
+        uint64_t numOfBits = other.bitCount();
+        std::vector<BYTE> bytes = other.takeData();
+        appendBits(bytes.data(), 0, numOfBits);
+    }
+
+    // appends numOfBits bits of source starting from bit bitOffset
+    void appendBits(const BYTE* source, uint64_t bitOffset, uint64_t numOfBits)
+    {
+        source += bitOffset / 8;
+        int skippedBits = static_cast<int>(bitOffset % 8);
+
+        if(skippedBits > 0 && numOfBits > 0)
+        {
+            int headBits = static_cast<uint64_t>(8 - skippedBits) < numOfBits ? 8 - skippedBits : static_cast<int>(numOfBits);
+            writeBits(*source++ >> (8 - skippedBits - headBits), headBits);
+            numOfBits -= headBits;
+        }
+
+        size_t fullBytes = static_cast<size_t>(numOfBits / 8);
+        int restBits = static_cast<int>(numOfBits % 8);
+
+        if(bufferedBits == 0)
+        {
+            countGrowth(fullBytes);
+            data.insert(data.end(), source, source + fullBytes);
+        }
+        else if(fullBytes > 0)
+        {
+            // every output byte is the buffered bits followed by the high bits of the next source byte
+            size_t start = data.size();
+            uint32_t mask = (1u << bufferedBits) - 1;
+            uint32_t pending = static_cast<uint32_t>(bitBuffer) & mask;
+            countGrowth(fullBytes);
+            data.resize(start + fullBytes);
+
+            for(size_t i = 0; i < fullBytes; ++i)
+            {
+                data[start + i] = static_cast<BYTE>(pending << (8 - bufferedBits) | source[i] >> bufferedBits);
+                pending = source[i] & mask;
             }
+
+            bitBuffer = pending;
         }
+
+        if(restBits > 0)
+        {
+            writeBits(source[fullBytes] >> (8 - restBits), restBits);
+        }
+    }
+
+    // times the buffer was allocated or grown, only counted with IMAGECOMPRESSOR_STATS
+    uint64_t allocations() const
+    {
+        return allocationCount;
     }
-    std::vector<BYTE> getData()
+
+private:
+    void countGrowth(size_t bytes)
     {
-        return data;
+#ifdef IMAGECOMPRESSOR_STATS
+        allocationCount += data.size() + bytes > data.capacity() ? 1 : 0;
+#else
+        (void)bytes;
+#endif
     }
 
 private:
     std::vector<BYTE> data;
-    int currentWriteIndex;
+    uint64_t bitBuffer;
+    int bufferedBits;
+    uint64_t allocationCount;
 };
 
 class BinaryReader
 {
 public:
-    BinaryReader(const std::vector<BYTE>& data): data{data}, readBit{7}, readIndex{0} {}
+    BinaryReader(const BYTE* data, size_t size): data{data}, size{size}, position{0} {}
+    explicit BinaryReader(const std::vector<BYTE>& data): BinaryReader(data.data(), data.size()) {}
 
-    BYTE readNextBit()
+    // next numOfBits (up to 24) bits without moving, bits past the end of data are zeros
+    uint32_t peekBits(int numOfBits) const
     {
-        BYTE val = 0x00;
+        size_t index = static_cast<size_t>(position / 8);
+        uint32_t window = 0;
 
-        if(!eof())
+        if(index + 4 <= size)
         {
-            val = (data[readIndex] >> readBit & 0x01) << 7;
-
-            readBit--;
-
-            if(readBit<0)
+            window = static_cast<uint32_t>(data[index]) << 24 | static_cast<uint32_t>(data[index + 1]) << 16
+                    | static_cast<uint32_t>(data[index + 2]) << 8 | data[index + 3];
+        }
+        else
+        {
+            for(size_t i = index; i < index + 4; ++i)
             {
-                readIndex++;
-                readBit = 7;
+                window = window << 8 | (i < size ? data[i] : 0);
             }
         }
 
-        return val;
+        return (window << (position % 8)) >> (32 - numOfBits);
     }
 
-    BYTE readNextByte()
+    void skipBits(int numOfBits) {position += numOfBits;}
+
+    uint32_t readBits(int numOfBits)
     {
-        BYTE val = 0x00;
+        uint32_t value = peekBits(numOfBits);
+        position += numOfBits;
+        return value;
+    }
 
-        int numBitsToRead = 8;
-        int bitToWrite = 7;
+    void seek(uint64_t bitOffset) {position = bitOffset;}
+    uint64_t tell() const {return position;}
+    uint64_t bitsLeft() const {return position < size * 8 ? size * 8 - position : 0;}
+    bool eof() const {return bitsLeft() == 0;}
 
-        while(!eof() && numBitsToRead>0)
-        {
-            val |= (data[readIndex] >> readBit & 0x01) << bitToWrite;
+private:
+    const BYTE* data;
+    size_t size;
+    uint64_t position;
+};
+
+// How DIFFERENT payload bytes are written: raw or with the image's Huffman code,
+// optionally as the difference to the pixel on the left.
+struct PayloadCoder
+{
+    PayloadCoding coding = PayloadCoding::RAW;
+    bool leftPrediction = false;
+    BYTE codeLengths[Detail::HUFFMAN_SYMBOLS];
+    uint16_t codes[Detail::HUFFMAN_SYMBOLS];
+    const Detail::HuffmanDecodeTable* decodeTable = nullptr;
+};
+
+// calls function(0) ... function(count - 1) on up to one thread per core. The first exception thrown by
+// function stops the items not yet started and is rethrown once every thread is done
+template<typename Function>
+void runInParallel(int count, const Function& function)
+{
+    unsigned cores = std::thread::hardware_concurrency();
+    int threadsCount = cores > 0 && static_cast<int>(cores) < count ? static_cast<int>(cores) : count;
+    std::atomic<int> next(0);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
 
-            --readBit;
-            --numBitsToRead;
-            --bitToWrite;
+    auto worker = [&]()
+    {
+        try
+        {
+            for(int i = next++; i < count; i = next++)
+            {
+                function(i);
+            }
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            next = count;
 
-            if(readBit<0)
+            if(!failure)
             {
-                readIndex++;
-                readBit = 7;
+                failure = std::current_exception();
             }
         }
+    };
+
+    std::vector<std::thread> threads;
+
+    for(int i = 1; i < threadsCount; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    if(failure)
+    {
+        std::rethrow_exception(failure);
+    }
+}
+
+const int PROGRESS_ROWS = 64; // rows between two progress reports of a thread
+
+// Progress of one call over all of its threads, the callback is called by one thread at a time
+class Progress
+{
+public:
+    Progress(const ProgressCallback& callback, uint64_t total): callback(callback), total{total}, done{0}, cancelled{false} {}
+
+    // adds rows done since the last call of the thread, throws once the call is cancelled
+    void advance(uint64_t rows)
+    {
+        uint64_t reached = done += rows;
+        // a thread finding the callback busy goes on, the next report includes its rows
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+
+        if(lock.owns_lock() && !cancelled && !callback(reached, total))
+        {
+            cancelled = true;
+        }
+
+        if(cancelled)
+        {
+            throw ImageCompressorException(ExceptionType::CANCELLED);
+        }
+    }
+
+private:
+    const ProgressCallback& callback;
+    uint64_t total;
+    std::atomic<uint64_t> done;
+    std::atomic<bool> cancelled;
+    std::mutex mutex;
+};
 
-        return val;
+// Planar rows are inserted into their channel by writing whole pixels back, so threads decoding other planes of the
+// same image row take turns. Image rows share a few locks
+class RowLocks
+{
+public:
+    std::mutex& of(int y)
+    {
+        return locks[y % ROW_LOCKS];
     }
 
-    bool eof() {return readIndex == data.size();}
 private:
-    const std::vector<BYTE>& data;
-    int readBit;
-    int readIndex;
+    static const int ROW_LOCKS = 64;
+    std::mutex locks[ROW_LOCKS];
 };
 
+// row raw of rows is done, progress is reported every PROGRESS_ROWS rows and after the last one
+void rowDone(Progress* progress, int raw, int rows)
+{
+    if(progress && ((raw + 1) % PROGRESS_ROWS == 0 || raw + 1 == rows))
+    {
+        progress->advance(raw % PROGRESS_ROWS + 1);
+    }
+}
+
+BYTE payloadSymbol(const BYTE* row, int column, bool leftPrediction)
+{
+    return leftPrediction ? static_cast<BYTE>(row[column] - (column > 0 ? row[column - 1] : 0)) : row[column];
+}
+
 //compression helpers
 bool isEmptyRaw(const unsigned char*begin, const unsigned char*end)
 {
@@ -137,7 +385,67 @@ bool isEmptyRaw(const unsigned char*begin, const unsigned char*end)
     return true;
 }
 
-void writeWithIdentifier(DataIdentifiers identifier, BinaryWriter& binaryData, BYTE* begin = nullptr, ImageCompressor::BYTE* end = nullptr)
+DataIdentifiers classifyGroup(const BYTE* group, int groupSize)
+{
+    if(groupSize == 4 && group[0] == group[1] && group[0] == group[2] && group[0] == group[3])
+    {
+        if(group[0] == static_cast<BYTE>(PixelColor::WHITE))
+        {
+            return DataIdentifiers::WHITE_IN_RAW;
+        }
+        else if(group[0] == static_cast<BYTE>(PixelColor::BLACK))
+        {
+            return DataIdentifiers::BLACK_IN_RAW;
+        }
+    }
+
+    return DataIdentifiers::DIFFERENT;
+}
+
+//calls function(column, groupSize, identifier) for every group of 4 pixels of row in order, a trailing group shorter
+//than 4 pixels is always DIFFERENT. Groups are classified 16 bytes at a time where SSE2 is there
+template<typename Function>
+void forEachGroup(const BYTE* row, int width, const Function& function)
+{
+    int column = 0;
+
+#ifdef IMAGECOMPRESSOR_GROUPS_SSE2
+    const __m128i white = _mm_set1_epi8(static_cast<char>(PixelColor::WHITE));
+    const __m128i black = _mm_set1_epi8(static_cast<char>(PixelColor::BLACK));
+
+    for(; column + 16 <= width; column += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + column));
+        int whiteMask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, white));
+        int blackMask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, black));
+
+        // a bit per byte, a group is WHITE or BLACK when all 4 of its bits are set
+        for(int group = 0; group < 16; group += 4)
+        {
+            DataIdentifiers identifier = DataIdentifiers::DIFFERENT;
+
+            if(((whiteMask >> group) & 0xf) == 0xf)
+            {
+                identifier = DataIdentifiers::WHITE_IN_RAW;
+            }
+            else if(((blackMask >> group) & 0xf) == 0xf)
+            {
+                identifier = DataIdentifiers::BLACK_IN_RAW;
+            }
+
+            function(column + group, 4, identifier);
+        }
+    }
+#endif
+
+    for(; column < width; column += 4)
+    {
+        int groupSize = width - column < 4 ? width - column : 4;
+        function(column, groupSize, classifyGroup(row + column, groupSize));
+    }
+}
+
+void writeWithIdentifier(DataIdentifiers identifier, BinaryWriter& binaryData, const BYTE* begin = nullptr, const BYTE* end = nullptr)
 {
     BYTE ident = static_cast<BYTE>(identifier);
 
@@ -165,193 +473,1845 @@ void writeWithIdentifier(DataIdentifiers identifier, BinaryWriter& binaryData, B
 
         break;
     }
+    default:
+        break;
     }
 }
 
-//decompression helpers
-DataIdentifiers readNextCommand(BinaryReader& reader)
+// symbol counts of a group of segments and the bits of their tokens, 1 for WHITE and 2 for the others
+struct SymbolFrequencies
 {
-    if(reader.eof())
+    uint64_t counts[Detail::HUFFMAN_SYMBOLS] = {};
+    uint64_t tokenBits = 0;
+};
+
+void countPayloadSymbols(const BYTE* row, int width, bool leftPrediction, SymbolFrequencies& frequencies)
+{
+    if(isEmptyRaw(row, row + width))
     {
-        return DataIdentifiers::UNKNOWN;
+        return;
     }
 
-    BYTE command = reader.readNextBit();
+    forEachGroup(row, width, [&](int column, int groupSize, DataIdentifiers identifier){
+        frequencies.tokenBits += identifier == DataIdentifiers::WHITE_IN_RAW ? 1 : 2;
 
-    if(static_cast<BYTE>(DataIdentifiers::WHITE_IN_RAW) == command)
-    {
-        return DataIdentifiers::WHITE_IN_RAW;
-    }
-    else
-    {
-        if(reader.eof())
+        if(identifier == DataIdentifiers::DIFFERENT)
         {
-            return DataIdentifiers::UNKNOWN;
+            for(int i = column; i < column + groupSize; ++i)
+            {
+                ++frequencies.counts[payloadSymbol(row, i, leftPrediction)];
+            }
         }
+    });
+}
 
-        command|=reader.readNextBit()>>1;
+//stored row raw of segment: straight from the image if it isn't planar, otherwise its channel is copied to buffer
+const BYTE* gatherStoredRow(const RawImageData& data, int planarChannels, const Detail::StoredSegment& segment, int raw, BYTE* buffer)
+{
+    const BYTE* imageRow = data.data + static_cast<size_t>(segment.y + raw) * data.width;
 
-        if(static_cast<BYTE>(DataIdentifiers::BLACK_IN_RAW) == command)
-        {
-            return DataIdentifiers::BLACK_IN_RAW;
-        }
-        else if(static_cast<BYTE>(DataIdentifiers::DIFFERENT) == command)
-        {
-            return DataIdentifiers::DIFFERENT;
-        }
-        else
-        {
-            return DataIdentifiers::UNKNOWN;
-        }
+    if(planarChannels == 0)
+    {
+        return imageRow + segment.x;
     }
-}
+
+    Detail::extractChannel(imageRow + static_cast<size_t>(segment.x) * planarChannels, planarChannels, segment.plane, segment.width, buffer);
+    return buffer;
 }
 
-ImageCompressor::CompressedImage ImageCompressor::compressImage(const RawImageData data)
+//CRC32C of stored rows [firstRow, lastRow), the rows may belong to several segments
+uint32_t storedRowsChecksum(const RawImageData& data, int planarChannels, const Detail::StoredLayout& layout, int firstRow, int lastRow)
 {
-    BinaryWriter binaryData;
-    std::vector<bool> indexes;
+    std::vector<BYTE> buffer(planarChannels != 0 ? layout.tileWidth : 0);
+    uint32_t checksum = 0;
 
-    for(int raw = 0; raw<data.height; ++raw)
+    while(firstRow < lastRow)
     {
-        if(isEmptyRaw(data.data + raw * data.width, data.data + (raw + 1) * data.width))
+        Detail::StoredSegment segment = Detail::storedSegment(layout, Detail::storedSegmentOfRow(layout, firstRow));
+        int segmentEnd = segment.firstRow + segment.height < lastRow ? segment.firstRow + segment.height : lastRow;
+
+        for(; firstRow < segmentEnd; ++firstRow)
         {
-            indexes.push_back(1);
+            checksum = crc32c(gatherStoredRow(data, planarChannels, segment, firstRow - segment.firstRow, buffer.data()), segment.width, checksum);
         }
-        else
-        {
-            indexes.push_back(0);
-            int samePixelsInRaw = 0;
-            int startPixelIndex = raw * data.width;
-            unsigned char startPixelData = data.data[startPixelIndex];
+    }
 
-            int endOfColumn = (raw+1) * data.width;
-            for(int column = startPixelIndex; column < endOfColumn;)
-            {
-                if(data.data[column] == startPixelData)
-                {
-                    ++samePixelsInRaw;
+    return checksum;
+}
 
-                    if(samePixelsInRaw == 4)
-                    {
-                        samePixelsInRaw = 0;
+//true if the filter of row raw of segment may use the row above it, which isn't so for the first rows of segments and bands
+bool filterUsesPrevRow(const Detail::StoredSegment& segment, int rowsPerBand, int raw)
+{
+    return raw > 0 && !(rowsPerBand && (segment.firstRow + raw) % rowsPerBand == 0);
+}
 
-                        if(startPixelData == static_cast<BYTE>(PixelColor::BLACK))
-                        {
-                            writeWithIdentifier(DataIdentifiers::BLACK_IN_RAW, binaryData);
-                        }
-                        else if(startPixelData == static_cast<BYTE>(PixelColor::WHITE))
-                        {
-                            writeWithIdentifier(DataIdentifiers::WHITE_IN_RAW, binaryData);
-                        }
-                        else
-                        {
-                            writeWithIdentifier(DataIdentifiers::DIFFERENT, binaryData, &data.data[startPixelIndex], &data.data[startPixelIndex] + 4);
-                        }
+//calls function(raw, original, row) for every row of segment, row is original after its filter or original itself without
+//rowFilters. Filters are taken from rowFilters if filtersChosen, otherwise they are chosen here and written to it.
+//Only two rows of the segment are held at a time.
+template<typename Function>
+void forEachSegmentRow(const RawImageData& data, int planarChannels, const Detail::StoredSegment& segment, int rowsPerBand,
+                       BYTE* rowFilters, bool filtersChosen, CodecStats* stats, Progress* progress, const Function& function)
+{
+    // planar rows are gathered into two buffers in turn, so the row above stays there for the filters
+    size_t width = static_cast<size_t>(segment.width);
+    std::vector<BYTE> gathered(planarChannels != 0 ? 2 * width : 0);
+    std::vector<BYTE> filtered(rowFilters ? 2 * width : 0);
+#ifdef IMAGECOMPRESSOR_STATS
+    IMAGECOMPRESSOR_COUNT(stats, allocations, (gathered.empty() ? 0 : 1) + (filtered.empty() ? 0 : 1));
+#else
+    (void)stats;
+#endif
+    const BYTE* prev = nullptr;
 
-                        startPixelIndex+=4;
-                        startPixelData = data.data[startPixelIndex];
-                        column = startPixelIndex;
-                        continue;
-                    }
-                }
-                else
-                {
-                    samePixelsInRaw = 0;
-                    int endCopyIndex = (startPixelIndex + 4) <= endOfColumn ? startPixelIndex + 4 : endOfColumn;
-                    int diff = endCopyIndex - startPixelIndex;
-                    writeWithIdentifier(DataIdentifiers::DIFFERENT, binaryData, &data.data[startPixelIndex], &data.data[startPixelIndex] + diff);
-                    startPixelIndex = endCopyIndex;
-                    startPixelData = data.data[startPixelIndex];
-                    column = startPixelIndex;
-                    continue;
-                }
+    for(int raw = 0; raw < segment.height; ++raw)
+    {
+        const BYTE* original = gatherStoredRow(data, planarChannels, segment, raw, planarChannels != 0 ? gathered.data() + (raw % 2) * width : nullptr);
+        const BYTE* row = original;
 
-                if(column == endOfColumn - 1)
-                {
-                    int diff = endOfColumn - startPixelIndex;
-                    writeWithIdentifier(DataIdentifiers::DIFFERENT, binaryData, &data.data[startPixelIndex], &data.data[startPixelIndex] + diff);
-                }
+        if(rowFilters)
+        {
+            int storedRow = segment.firstRow + raw;
+            bool usePrev = filterUsesPrevRow(segment, rowsPerBand, raw);
+
+            // without the row above only NONE and SUB are used, they don't read it
+            const BYTE* above = usePrev ? prev : original;
 
-                ++column;
+            if(filtersChosen)
+            {
+                Detail::filterRow(static_cast<Detail::RowFilter>(rowFilters[storedRow]), original, above, filtered.data(), segment.width);
+            }
+            else
+            {
+                Detail::RowFilter filter = Detail::filterRowAdaptive(original, above, filtered.data(), filtered.data() + width, segment.width, usePrev);
+                rowFilters[storedRow] = static_cast<BYTE>(filter);
             }
+
+            row = filtered.data();
         }
+
+        function(raw, original, row);
+        prev = original;
+        rowDone(progress, raw, segment.height);
     }
+}
 
-    CompressedImage compressed;
-    compressed.width = data.width;
-    compressed.height = data.height;
-    compressed.compressedIndexes = std::move(indexes);
-    compressed.data = binaryData.getData();
+//counts a group of pixels under its identifier
+void countGroup(CodecStats* stats, DataIdentifiers identifier)
+{
+#ifdef IMAGECOMPRESSOR_STATS
+    IMAGECOMPRESSOR_COUNT(stats, whiteGroups, identifier == DataIdentifiers::WHITE_IN_RAW ? 1 : 0);
+    IMAGECOMPRESSOR_COUNT(stats, blackGroups, identifier == DataIdentifiers::BLACK_IN_RAW ? 1 : 0);
+    IMAGECOMPRESSOR_COUNT(stats, differentGroups, identifier == DataIdentifiers::DIFFERENT ? 1 : 0);
+#else
+    (void)stats;
+    (void)identifier;
+#endif
+}
 
-    return compressed;
+//adds the counters of part to stats
+void addStats(CodecStats& stats, const CodecStats& part)
+{
+    stats.emptyRows += part.emptyRows;
+    stats.whiteGroups += part.whiteGroups;
+    stats.blackGroups += part.blackGroups;
+    stats.differentGroups += part.differentGroups;
+    stats.allocations += part.allocations;
 }
 
-ImageCompressor::RawImageData ImageCompressor::decompressImage(const CompressedImage data)
+// counters of one parallel task, null when they are compiled out
+CodecStats* taskStats(std::vector<CodecStats>& stats, int task)
 {
-    RawImageData imageData;
+    return stats.empty() ? nullptr : &stats[task];
+}
+
+// sets CodecStats::seconds to its own lifetime, does nothing without IMAGECOMPRESSOR_STATS
+class StatsTimer
+{
+public:
+#ifdef IMAGECOMPRESSOR_STATS
+    explicit StatsTimer(CodecStats& stats): stats(stats), start{std::chrono::steady_clock::now()} {}
+    ~StatsTimer()
+    {
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
 
-    int decompressedBytes = 0;
+private:
+    CodecStats& stats;
+    std::chrono::steady_clock::time_point start;
+#else
+    explicit StatsTimer(CodecStats&) {}
+#endif
+};
 
-    std::vector<BYTE> decompressedData;
-    BinaryReader reader(data.data);
+//encodes row as groups of 4 pixels, a trailing group shorter than 4 pixels is always DIFFERENT
+void encodeRow(const BYTE* row, int width, BinaryWriter& binaryData, const PayloadCoder& coder, CodecStats* stats)
+{
+    forEachGroup(row, width, [&](int column, int groupSize, DataIdentifiers identifier){
+        countGroup(stats, identifier);
 
-    for(auto index : data.compressedIndexes)
-    {
-        if(index == 1)
+        if(identifier != DataIdentifiers::DIFFERENT)
         {
-            decompressedData.insert(decompressedData.end(), data.width, static_cast<BYTE>(PixelColor::WHITE));
-            decompressedBytes += data.width;
+            writeWithIdentifier(identifier, binaryData);
+        }
+        else if(coder.coding == PayloadCoding::RAW && !coder.leftPrediction)
+        {
+            writeWithIdentifier(identifier, binaryData, row + column, row + column + groupSize);
         }
         else
         {
-            int readRawBytes = 0;
+            writeWithIdentifier(identifier, binaryData);
 
-            while(!reader.eof() && readRawBytes<data.width)
+            for(int i = column; i < column + groupSize; ++i)
             {
-                auto command = readNextCommand(reader);
+                BYTE symbol = payloadSymbol(row, i, coder.leftPrediction);
 
-                if(command == DataIdentifiers::UNKNOWN)
-                {
-                    throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
-                }
-                else if(command == DataIdentifiers::BLACK_IN_RAW)
+                if(coder.coding == PayloadCoding::HUFFMAN)
                 {
-                    decompressedData.insert(decompressedData.end(), 4, static_cast<BYTE>(PixelColor::BLACK));
-                    readRawBytes += 4;
+                    binaryData.writeBits(coder.codes[symbol], coder.codeLengths[symbol]);
                 }
-                else if(command == DataIdentifiers::WHITE_IN_RAW)
+                else
                 {
-                    decompressedData.insert(decompressedData.end(), 4, static_cast<BYTE>(PixelColor::WHITE));
-                    readRawBytes += 4;
+                    binaryData.writeBits(symbol, 8);
                 }
-                else if(command == DataIdentifiers::DIFFERENT)
-                {
-                    int numBytesToRead = (data.width - readRawBytes) < 4 ? data.width - readRawBytes : 4 ;
+            }
+        }
+    });
+}
 
-                    while(!reader.eof() && numBytesToRead>0)
-                    {
-                        decompressedData.push_back(reader.readNextByte());
+//true if band has rows of more than one segment
+bool bandSpansSegments(const Detail::StoredLayout& layout, int rowsPerBand, int band)
+{
+    int firstRow = band * rowsPerBand;
+    int lastRow = layout.rows - firstRow < rowsPerBand ? layout.rows : firstRow + rowsPerBand;
+    return Detail::storedSegmentOfRow(layout, firstRow) != Detail::storedSegmentOfRow(layout, lastRow - 1);
+}
 
-                        --numBytesToRead;
-                        readRawBytes += 1;
-                    }
-                }
-            }
+//encodes the rows of segment, band checksums and row hashes are taken from the original rows
+//checksums of bands which span several segments are left to the caller
+//band and row offsets are relative to the start of binaryData, rows aren't indexed if rowOffsets is empty
+void encodeSegment(const RawImageData& data, int planarChannels, const Detail::StoredLayout& layout, const Detail::StoredSegment& segment,
+                   int rowsPerBand, const PayloadCoder& coder, BYTE* rowFilters, bool filtersChosen, BinaryWriter& binaryData,
+                   std::vector<bool>& indexes, std::vector<BandInfo>& bands, std::vector<uint64_t>& rowHashes, std::vector<uint64_t>& rowOffsets,
+                   CodecStats* stats, Progress* progress)
+{
+    uint32_t checksum = 0;
 
-            decompressedBytes += readRawBytes;
+    forEachSegmentRow(data, planarChannels, segment, rowsPerBand, rowFilters, filtersChosen, stats, progress, [&](int raw, const BYTE* original, const BYTE* row){
+        int storedRow = segment.firstRow + raw;
+
+        if(!rowOffsets.empty())
+        {
+            rowOffsets[storedRow] = binaryData.bitCount();
+            rowHashes[storedRow] = xxhash64(original, segment.width);
         }
-    }
 
-    if(decompressedBytes < data.width*data.height)
-    {
-        throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
-    }
+        if(rowsPerBand)
+        {
+            if(storedRow % rowsPerBand == 0)
+            {
+                bands[storedRow / rowsPerBand].bitOffset = binaryData.bitCount();
+                checksum = 0;
+            }
 
-    imageData.height = data.height;
-    imageData.width = data.width;
-    imageData.data = new BYTE[decompressedData.size()];
-    memcpy(imageData.data, decompressedData.data(), decompressedData.size());
+            checksum = crc32c(original, segment.width, checksum);
 
-    return imageData;
+            // the band ends here and started in this segment
+            if(((storedRow + 1) % rowsPerBand == 0 || storedRow + 1 == layout.rows) && storedRow - storedRow % rowsPerBand >= segment.firstRow)
+            {
+                bands[storedRow / rowsPerBand].checksum = checksum;
+            }
+        }
+
+        if(isEmptyRaw(row, row + segment.width))
+        {
+            indexes.push_back(1);
+            IMAGECOMPRESSOR_COUNT(stats, emptyRows, 1);
+        }
+        else
+        {
+            indexes.push_back(0);
+            encodeRow(row, segment.width, binaryData, coder, stats);
+        }
+    });
+}
+
+//true if the row index and tables of previous fit the layout, so its unchanged rows can be copied
+bool canRecompress(const CompressedImage& previous, const RawImageData& data, const Detail::StoredLayout& layout)
+{
+    size_t rows = static_cast<size_t>(layout.rows);
+    size_t bandsCount = previous.rowsPerBand > 0 ? (rows + previous.rowsPerBand - 1) / previous.rowsPerBand : 0;
+
+    if(previous.width != data.width || previous.height != data.height
+            || previous.rowHashes.size() != rows || previous.rowOffsets.size() != rows + 1
+            || previous.compressedIndexes.size() != rows || previous.bands.size() != bandsCount
+            || (!previous.rowFilters.empty() && previous.rowFilters.size() != rows)
+            || (previous.payloadCoding == PayloadCoding::HUFFMAN && previous.codeLengths.size() != Detail::HUFFMAN_SYMBOLS))
+    {
+        return false;
+    }
+
+    // changed rows may have any byte, so the table taken over must have a code for every one, as buildHuffmanCodeLengths gives
+    if(previous.payloadCoding == PayloadCoding::HUFFMAN && std::count(previous.codeLengths.begin(), previous.codeLengths.end(), 0) != 0)
+    {
+        return false;
+    }
+
+    for(size_t row = 0; row < rows; ++row)
+    {
+        if(previous.rowOffsets[row] > previous.rowOffsets[row + 1])
+        {
+            return false;
+        }
+    }
+
+    return previous.rowOffsets[rows] <= static_cast<uint64_t>(previous.data.size()) * 8;
+}
+
+//decompression helpers
+DataIdentifiers readNextCommand(BinaryReader& reader)
+{
+    if(reader.eof())
+    {
+        return DataIdentifiers::UNKNOWN;
+    }
+
+    if(reader.readBits(1) == 0)
+    {
+        return DataIdentifiers::WHITE_IN_RAW;
+    }
+
+    if(reader.eof())
+    {
+        return DataIdentifiers::UNKNOWN;
+    }
+
+    return reader.readBits(1) == 0 ? DataIdentifiers::BLACK_IN_RAW : DataIdentifiers::DIFFERENT;
+}
+
+// WHITE (0) and BLACK (10) tokens at the start of every byte of the stream, so rows which are only
+// walked skip up to 8 uniform groups at once
+struct UniformTokenRuns
+{
+    BYTE groups[256];
+    BYTE bits[256];
+
+    UniformTokenRuns()
+    {
+        for(int value = 0; value < 256; ++value)
+        {
+            int position = 0;
+            groups[value] = 0;
+
+            while(position < 8)
+            {
+                bool one = (value << position & 0x80) != 0;
+
+                if(one && (position == 7 || (value << (position + 1) & 0x80) != 0))
+                {
+                    break;
+                }
+
+                position += one ? 2 : 1;
+                ++groups[value];
+            }
+
+            bits[value] = static_cast<BYTE>(position);
+        }
+    }
+};
+
+const UniformTokenRuns& uniformTokenRuns()
+{
+    static const UniformTokenRuns runs;
+    return runs;
+}
+
+void preparePayloadDecoder(PayloadCoding coding, bool leftPrediction, const BYTE* codeLengths, Detail::HuffmanDecodeTable& table, PayloadCoder& coder)
+{
+    coder.coding = coding;
+    coder.leftPrediction = leftPrediction;
+
+    if(coding == PayloadCoding::HUFFMAN)
+    {
+        if(!codeLengths || !table.build(codeLengths))
+        {
+            throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
+        }
+
+        coder.decodeTable = &table;
+    }
+}
+
+//decodes one not empty row, returns false if data is over or corrupted
+//without WritePixels only walks the tokens and row may be null
+//with Scale > 1 only every Scale-th byte is kept, byte i goes to row[i / Scale]
+template<bool WritePixels, int Scale = 1>
+bool decodeRow(BinaryReader& reader, BYTE* row, int width, const PayloadCoder& coder, CodecStats* stats = nullptr)
+{
+    int readRawBytes = 0;
+    BYTE left = 0;
+
+    while(readRawBytes < width)
+    {
+        if(!WritePixels && width - readRawBytes >= 32 && reader.bitsLeft() >= 8)
+        {
+            const UniformTokenRuns& runs = uniformTokenRuns();
+            uint32_t tokens = reader.peekBits(8);
+
+            if(runs.groups[tokens] > 0)
+            {
+                reader.skipBits(runs.bits[tokens]);
+                readRawBytes += 4 * runs.groups[tokens];
+                continue;
+            }
+        }
+
+        auto command = readNextCommand(reader);
+        countGroup(stats, command);
+
+        if(command == DataIdentifiers::BLACK_IN_RAW || command == DataIdentifiers::WHITE_IN_RAW)
+        {
+            if(width - readRawBytes < 4)
+            {
+                return false;
+            }
+
+            if(WritePixels)
+            {
+                BYTE color = static_cast<BYTE>(command == DataIdentifiers::BLACK_IN_RAW ? PixelColor::BLACK : PixelColor::WHITE);
+
+                if(Scale == 1)
+                {
+                    memset(row + readRawBytes, color, 4);
+                }
+                else
+                {
+                    // a uniform group is never expanded, only its sampled bytes are set
+                    for(int i = (readRawBytes + Scale - 1) / Scale * Scale; i < readRawBytes + 4; i += Scale)
+                    {
+                        row[i / Scale] = color;
+                    }
+                }
+
+                left = color;
+            }
+
+            readRawBytes += 4;
+        }
+        else if(command == DataIdentifiers::DIFFERENT)
+        {
+            int numBytesToRead = (width - readRawBytes) < 4 ? width - readRawBytes : 4;
+
+            if(!WritePixels && coder.coding == PayloadCoding::RAW)
+            {
+                if(reader.bitsLeft() < 8u * numBytesToRead)
+                {
+                    return false;
+                }
+
+                reader.skipBits(8 * numBytesToRead);
+                readRawBytes += numBytesToRead;
+                continue;
+            }
+
+            while(numBytesToRead > 0)
+            {
+                uint32_t symbol = 0;
+
+                if(coder.coding == PayloadCoding::HUFFMAN)
+                {
+                    uint16_t entry = coder.decodeTable->lookup(reader.peekBits(Detail::HUFFMAN_MAX_CODE_LENGTH));
+                    int length = entry >> 8;
+
+                    if(length == 0 || static_cast<uint64_t>(length) > reader.bitsLeft())
+                    {
+                        return false;
+                    }
+
+                    reader.skipBits(length);
+                    symbol = entry & 0xff;
+                }
+                else
+                {
+                    if(reader.bitsLeft() < 8)
+                    {
+                        return false;
+                    }
+
+                    symbol = reader.readBits(8);
+                }
+
+                if(WritePixels)
+                {
+                    BYTE value = static_cast<BYTE>(coder.leftPrediction ? symbol + left : symbol);
+                    left = value;
+
+                    if(Scale == 1 || readRawBytes % Scale == 0)
+                    {
+                        row[readRawBytes / Scale] = value;
+                    }
+                }
+
+                --numBytesToRead;
+                readRawBytes += 1;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//decodes row raw of segment, counted from its first row, and reverses its filter, prev is the row above it
+//returns false if data is over or corrupted
+bool decodeSegmentRow(const CompressedImage& data, const Detail::StoredSegment& segment, BinaryReader& reader, const PayloadCoder& coder,
+                      int raw, BYTE* row, const BYTE* prev, CodecStats* stats = nullptr)
+{
+    int storedRow = segment.firstRow + raw;
+
+    if(data.compressedIndexes[storedRow])
+    {
+        memset(row, static_cast<BYTE>(PixelColor::WHITE), segment.width);
+        IMAGECOMPRESSOR_COUNT(stats, emptyRows, 1);
+    }
+    else if(!decodeRow<true>(reader, row, segment.width, coder, stats))
+    {
+        return false;
+    }
+
+    if(!data.rowFilters.empty())
+    {
+        Detail::RowFilter filter = static_cast<Detail::RowFilter>(data.rowFilters[storedRow]);
+
+        // first rows of segments and bands are decoded without the previous one, so they can only be filtered by the left byte.
+        // The row above may be another band's, decoded by another thread, so it isn't touched at all
+        bool usePrev = filterUsesPrevRow(segment, data.rowsPerBand, raw);
+
+        if(data.rowFilters[storedRow] >= Detail::ROW_FILTERS_COUNT || (!usePrev && filter > Detail::RowFilter::SUB))
+        {
+            return false;
+        }
+
+        Detail::unfilterRow(filter, row, usePrev ? prev : row, segment.width);
+    }
+
+    return true;
+}
+
+//decodes rows [firstRow, lastRow) of segment, counted from its first row, into pixels of the decompressed image
+//rows of images which aren't planar are decoded in place, planar ones go through rowBuffer (two rows of the segment)
+//into their channel, under rowLocks if other planes are decoded at the same time. checksum, if not null, is continued
+//over the decoded rows. Returns false if data is over or corrupted
+bool decodeSegmentToImage(const CompressedImage& data, const Detail::StoredSegment& segment, BinaryReader& reader, const PayloadCoder& coder,
+                          int firstRow, int lastRow, BYTE* pixels, BYTE* rowBuffer, uint32_t* checksum, CodecStats* stats, Progress* progress,
+                          RowLocks* rowLocks)
+{
+    int channels = data.planarChannels;
+    size_t width = static_cast<size_t>(segment.width);
+
+    for(int raw = firstRow; raw < lastRow; ++raw)
+    {
+        BYTE* imageRow = pixels + static_cast<size_t>(segment.y + raw) * data.width;
+        BYTE* row = imageRow + segment.x;
+        const BYTE* prev = raw > 0 ? row - data.width : row;
+
+        if(channels != 0)
+        {
+            row = rowBuffer + (raw % 2) * width;
+            prev = rowBuffer + ((raw + 1) % 2) * width;
+        }
+
+        if(!decodeSegmentRow(data, segment, reader, coder, raw, row, prev, stats))
+        {
+            return false;
+        }
+
+        if(checksum)
+        {
+            *checksum = crc32c(row, width, *checksum);
+        }
+
+        if(channels != 0)
+        {
+            std::unique_lock<std::mutex> lock;
+
+            if(rowLocks)
+            {
+                lock = std::unique_lock<std::mutex>(rowLocks->of(segment.y + raw));
+            }
+
+            Detail::insertChannel(row, channels, segment.plane, segment.width, imageRow + static_cast<size_t>(segment.x) * channels);
+        }
+
+        rowDone(progress, raw - firstRow, lastRow - firstRow);
+    }
+
+    return true;
+}
+
+//decodes stored rows [firstRow, lastRow) into pixels, the rows may belong to several segments
+bool decodeStoredRows(const CompressedImage& data, const Detail::StoredLayout& layout, BinaryReader& reader, const PayloadCoder& coder,
+                      int firstRow, int lastRow, BYTE* pixels, BYTE* rowBuffer, uint32_t* checksum, CodecStats* stats, Progress* progress,
+                      RowLocks* rowLocks)
+{
+    while(firstRow < lastRow)
+    {
+        Detail::StoredSegment segment = Detail::storedSegment(layout, Detail::storedSegmentOfRow(layout, firstRow));
+        int segmentEnd = segment.firstRow + segment.height < lastRow ? segment.firstRow + segment.height : lastRow;
+
+        if(!decodeSegmentToImage(data, segment, reader, coder, firstRow - segment.firstRow, segmentEnd - segment.firstRow, pixels, rowBuffer,
+                                 checksum, stats, progress, rowLocks))
+        {
+            return false;
+        }
+
+        firstRow = segmentEnd;
+    }
+
+    return true;
+}
+
+//fills stored rows [firstRow, lastRow) of the decompressed image with white
+void fillStoredRows(const CompressedImage& data, const Detail::StoredLayout& layout, int firstRow, int lastRow, BYTE* pixels, RowLocks* rowLocks)
+{
+    std::vector<BYTE> white(data.planarChannels != 0 ? layout.tileWidth : 0, static_cast<BYTE>(PixelColor::WHITE));
+
+    for(; firstRow < lastRow; ++firstRow)
+    {
+        Detail::StoredSegment segment = Detail::storedSegment(layout, Detail::storedSegmentOfRow(layout, firstRow));
+        BYTE* imageRow = pixels + static_cast<size_t>(segment.y + firstRow - segment.firstRow) * data.width;
+
+        if(data.planarChannels != 0)
+        {
+            std::unique_lock<std::mutex> lock;
+
+            if(rowLocks)
+            {
+                lock = std::unique_lock<std::mutex>(rowLocks->of(segment.y + firstRow - segment.firstRow));
+            }
+
+            Detail::insertChannel(white.data(), data.planarChannels, segment.plane, segment.width,
+                                  imageRow + static_cast<size_t>(segment.x) * data.planarChannels);
+        }
+        else
+        {
+            memset(imageRow + segment.x, static_cast<BYTE>(PixelColor::WHITE), segment.width);
+        }
+    }
+}
+
+//decodes every scale-th byte of a not empty row to sampled[i / scale]
+bool decodeSampledRow(BinaryReader& reader, BYTE* sampled, int width, int scale, const PayloadCoder& coder)
+{
+    switch(scale)
+    {
+    case 2:
+        return decodeRow<true, 2>(reader, sampled, width, coder);
+    case 4:
+        return decodeRow<true, 4>(reader, sampled, width, coder);
+    default:
+        return decodeRow<true, 8>(reader, sampled, width, coder);
+    }
+}
+
+//true if stored row raw of segment is filtered with the row above it
+bool rowUsesRowAbove(const CompressedImage& data, const Detail::StoredSegment& segment, int raw)
+{
+    return !data.rowFilters.empty() && filterUsesPrevRow(segment, data.rowsPerBand, raw)
+            && data.rowFilters[segment.firstRow + raw] > static_cast<BYTE>(Detail::RowFilter::SUB);
+}
+
+//decodes every scale-th row and column of a plane covered by segment into preview, a plane of previewWidth bytes per row.
+//With the row index (indexed) the reader seeks to each sampled row, or for filtered rows to the nearest row above it which
+//doesn't use the row above, and rows in between are never read. Without it rows which aren't sampled are walked, filtered
+//ones are decoded in full
+bool decodeSegmentPreview(const CompressedImage& data, const Detail::StoredSegment& segment, BinaryReader& reader, const PayloadCoder& coder,
+                          bool indexed, int scale, int previewWidth, BYTE* preview)
+{
+    // columns of the segment which are sampled start at firstColumn
+    int firstColumn = (scale - segment.x % scale) % scale;
+    int sampledColumns = firstColumn < segment.width ? (segment.width - firstColumn - 1) / scale + 1 : 0;
+    bool filtered = !data.rowFilters.empty();
+
+    std::vector<BYTE> rows(static_cast<size_t>(segment.width) * (filtered ? 2 : 1));
+    BYTE* row = rows.data();
+    BYTE* prev = filtered ? row + segment.width : row;
+
+    auto decodePreviewRow = [&](int raw){
+        int y = segment.y + raw;
+        bool sampledRow = y % scale == 0;
+        BYTE* sampled = preview + static_cast<size_t>(y / scale) * previewWidth + (segment.x + firstColumn) / scale;
+
+        if(filtered || (sampledRow && firstColumn != 0 && !data.compressedIndexes[segment.firstRow + raw]))
+        {
+            if(!decodeSegmentRow(data, segment, reader, coder, raw, row, prev))
+            {
+                return false;
+            }
+
+            if(sampledRow)
+            {
+                for(int i = 0; i < sampledColumns; ++i)
+                {
+                    sampled[i] = row[firstColumn + i * scale];
+                }
+            }
+
+            std::swap(row, prev);
+        }
+        else if(data.compressedIndexes[segment.firstRow + raw])
+        {
+            if(sampledRow)
+            {
+                memset(sampled, static_cast<BYTE>(PixelColor::WHITE), sampledColumns);
+            }
+        }
+        else if(!sampledRow)
+        {
+            return decodeRow<false>(reader, nullptr, segment.width, coder);
+        }
+        else
+        {
+            return decodeSampledRow(reader, sampled, segment.width, scale, coder);
+        }
+
+        return true;
+    };
+
+    if(!indexed)
+    {
+        for(int raw = 0; raw < segment.height; ++raw)
+        {
+            if(!decodePreviewRow(raw))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // rows before decodedTo are passed, prev holds the last one decoded
+    int decodedTo = 0;
+
+    for(int raw = (scale - segment.y % scale) % scale; raw < segment.height; raw += scale)
+    {
+        int first = raw;
+
+        while(first > decodedTo && rowUsesRowAbove(data, segment, first))
+        {
+            --first;
+        }
+
+        reader.seek(data.rowOffsets[segment.firstRow + first]);
+
+        for(int decoded = first; decoded <= raw; ++decoded)
+        {
+            if(!decodePreviewRow(decoded))
+            {
+                return false;
+            }
+        }
+
+        decodedTo = raw + 1;
+    }
+
+    return true;
+}
+
+void checkImageSize(const CompressedImage& data, Detail::StoredLayout& layout)
+{
+    if(!Detail::storedLayout(data.width, data.height, data.planarChannels, data.pixelsPerRow, data.tileWidth, data.tileHeight, layout)
+            || data.compressedIndexes.size() != static_cast<size_t>(layout.rows)
+            || (!data.rowFilters.empty() && data.rowFilters.size() != static_cast<size_t>(layout.rows))
+            || (!data.segmentOffsets.empty() && data.segmentOffsets.size() != static_cast<size_t>(layout.segments)))
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
+    }
+}
+
+void prepareDecoder(const CompressedImage& data, Detail::StoredLayout& layout, Detail::HuffmanDecodeTable& table, PayloadCoder& coder)
+{
+    checkImageSize(data, layout);
+
+    if(data.payloadCoding == PayloadCoding::HUFFMAN && data.codeLengths.size() != Detail::HUFFMAN_SYMBOLS)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
+    }
+
+    preparePayloadDecoder(data.payloadCoding, data.leftPrediction, data.codeLengths.data(), table, coder);
+}
+
+//image of data's size for the decoded rows, bytes after the pixels of planar rows are padding and set to zero
+std::unique_ptr<BYTE[]> allocateImage(const CompressedImage& data)
+{
+    std::unique_ptr<BYTE[]> pixels(new BYTE[static_cast<size_t>(data.width) * data.height]);
+    int rowBytes = data.pixelsPerRow * data.planarChannels;
+
+    for(int y = 0; data.planarChannels != 0 && rowBytes < data.width && y < data.height; ++y)
+    {
+        memset(pixels.get() + static_cast<size_t>(y) * data.width + rowBytes, 0, data.width - rowBytes);
+    }
+
+    return pixels;
+}
+
+RawImageData makeImage(const CompressedImage& data, std::unique_ptr<BYTE[]> pixels)
+{
+    RawImageData imageData;
+    imageData.height = data.height;
+    imageData.width = data.width;
+    imageData.data = pixels.release();
+
+    return imageData;
+}
+
+RawImageData decodeImage(const CompressedImage& data, CodecStats* stats, const ProgressCallback& callback)
+{
+    IMAGECOMPRESSOR_TRACE_SPAN("decompressImage");
+    PayloadCoder coder;
+    Detail::StoredLayout layout;
+    std::unique_ptr<Detail::HuffmanDecodeTable> table(new Detail::HuffmanDecodeTable());
+    prepareDecoder(data, layout, *table, coder);
+
+    Progress tracker(callback, static_cast<uint64_t>(layout.rows));
+    Progress* progress = callback ? &tracker : nullptr;
+
+    // rows are decoded straight into the image, planar ones through a buffer of two rows
+    std::unique_ptr<BYTE[]> pixels = allocateImage(data);
+    size_t rowBufferSize = data.planarChannels != 0 ? 2 * static_cast<size_t>(layout.tileWidth) : 0;
+    bool decoded = true;
+    IMAGECOMPRESSOR_COUNT(stats, allocations, 1);
+
+    if(layout.segments > 1 && !data.segmentOffsets.empty())
+    {
+        // every segment starts at a known offset, so tiles and planes are all decoded in parallel
+        std::vector<char> segmentDecoded(layout.segments, 0);
+        std::vector<CodecStats> segmentStats(COUNTING_STATS && stats ? layout.segments : 0);
+        std::unique_ptr<RowLocks> rowLocks(layout.planes > 1 ? new RowLocks() : nullptr);
+
+        runInParallel(layout.segments, [&](int index){
+            IMAGECOMPRESSOR_TRACE_SPAN("decode segment", index);
+            Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+            std::vector<BYTE> rowBuffer(rowBufferSize);
+            BinaryReader reader(data.data);
+            IMAGECOMPRESSOR_COUNT(taskStats(segmentStats, index), allocations, rowBufferSize != 0 ? 1 : 0);
+
+            reader.seek(data.segmentOffsets[index]);
+            segmentDecoded[index] = decodeSegmentToImage(data, segment, reader, coder, 0, segment.height, pixels.get(), rowBuffer.data(), nullptr,
+                                                         taskStats(segmentStats, index), progress, rowLocks.get());
+        });
+
+        for(char segmentResult : segmentDecoded)
+        {
+            decoded = decoded && segmentResult;
+        }
+
+        for(const CodecStats& part : segmentStats)
+        {
+            addStats(*stats, part);
+        }
+    }
+    else
+    {
+        std::vector<BYTE> rowBuffer(rowBufferSize);
+        BinaryReader reader(data.data);
+        IMAGECOMPRESSOR_COUNT(stats, allocations, rowBufferSize != 0 ? 1 : 0);
+        decoded = decodeStoredRows(data, layout, reader, coder, 0, layout.rows, pixels.get(), rowBuffer.data(), nullptr, stats, progress, nullptr);
+    }
+
+    if(!decoded)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
+    }
+
+    return makeImage(data, std::move(pixels));
+}
+}
+
+bool ImageCompressor::Detail::storedLayout(int width, int height, int planarChannels, int pixelsPerRow, int tileWidth, int tileHeight, StoredLayout& layout)
+{
+    // every dimension fits an int, sizes and positions made of them are 64-bit
+    if(width < 0 || height < 0 || tileWidth < 0 || tileHeight < 0 || (tileWidth == 0) != (tileHeight == 0)
+            || static_cast<uint64_t>(width) * static_cast<uint64_t>(height) > SIZE_MAX)
+    {
+        return false;
+    }
+
+    layout.width = width;
+    layout.height = height;
+    layout.planes = 1;
+
+    if(planarChannels != 0)
+    {
+        if(planarChannels < 2 || planarChannels > 4 || pixelsPerRow < 0 || pixelsPerRow > width / planarChannels)
+        {
+            return false;
+        }
+
+        layout.width = pixelsPerRow;
+        layout.planes = planarChannels;
+    }
+
+    bool tiled = tileWidth != 0;
+    layout.tileWidth = tiled ? tileWidth : layout.width;
+    layout.tileHeight = tiled ? tileHeight : layout.height;
+    layout.tilesX = tiled && layout.width > 0 ? (layout.width - 1) / tileWidth + 1 : 1;
+    layout.tilesY = tiled && layout.height > 0 ? (layout.height - 1) / tileHeight + 1 : 1;
+
+    int64_t rows = static_cast<int64_t>(layout.planes) * layout.height * layout.tilesX;
+    int64_t segments = static_cast<int64_t>(layout.planes) * layout.tilesX * layout.tilesY;
+
+    if(rows > INT_MAX || segments > INT_MAX)
+    {
+        return false;
+    }
+
+    layout.rows = static_cast<int>(rows);
+    layout.segments = static_cast<int>(segments);
+    return true;
+}
+
+ImageCompressor::Detail::StoredSegment ImageCompressor::Detail::storedSegment(const StoredLayout& layout, int index)
+{
+    int tilesPerPlane = layout.tilesX * layout.tilesY;
+    int tile = index % tilesPerPlane;
+    int tileX = tile % layout.tilesX;
+
+    StoredSegment segment;
+    segment.plane = index / tilesPerPlane;
+    segment.x = tileX * layout.tileWidth;
+    segment.y = tile / layout.tilesX * layout.tileHeight;
+    segment.width = layout.width - segment.x < layout.tileWidth ? layout.width - segment.x : layout.tileWidth;
+    segment.height = layout.height - segment.y < layout.tileHeight ? layout.height - segment.y : layout.tileHeight;
+
+    // a plane is layout.height * tilesX stored rows, a full row of tiles is tileHeight * tilesX of them
+    segment.firstRow = static_cast<int>(static_cast<int64_t>(segment.plane) * layout.height * layout.tilesX
+                                        + static_cast<int64_t>(segment.y) * layout.tilesX + static_cast<int64_t>(tileX) * segment.height);
+
+    return segment;
+}
+
+int ImageCompressor::Detail::storedSegmentOfRow(const StoredLayout& layout, int row)
+{
+    int64_t planeRows = static_cast<int64_t>(layout.height) * layout.tilesX;
+    int64_t tileRowRows = static_cast<int64_t>(layout.tileHeight) * layout.tilesX;
+
+    int plane = static_cast<int>(row / planeRows);
+    int64_t rest = row % planeRows;
+    int tileY = static_cast<int>(rest / tileRowRows);
+    rest -= tileY * tileRowRows;
+
+    int tileTop = tileY * layout.tileHeight;
+    int tileHeight = layout.height - tileTop < layout.tileHeight ? layout.height - tileTop : layout.tileHeight;
+    int tileX = static_cast<int>(rest / tileHeight);
+
+    return (plane * layout.tilesY + tileY) * layout.tilesX + tileX;
+}
+
+ImageCompressor::CompressedImage ImageCompressor::compressImage(const RawImageData& data)
+{
+    return compressImage(data, CompressionOptions());
+}
+
+ImageCompressor::CompressedImage ImageCompressor::compressImage(const RawImageData& data, const CompressionOptions& options)
+{
+    CodecStats stats;
+    return compressImage(data, options, stats);
+}
+
+ImageCompressor::CompressedImage ImageCompressor::compressImage(const RawImageData& data, const CompressionOptions& options, CodecStats& stats)
+{
+    return compressImage(data, options, stats, ProgressCallback());
+}
+
+ImageCompressor::CompressedImage ImageCompressor::compressImage(const RawImageData& data, const CompressionOptions& options, CodecStats& stats,
+                                                                const ProgressCallback& callback)
+{
+    IMAGECOMPRESSOR_TRACE_SPAN("compressImage");
+    StatsTimer timer(stats);
+    Detail::StoredLayout layout;
+
+    if(!Detail::storedLayout(data.width, data.height, options.planarChannels, options.pixelsPerRow, options.tileWidth, options.tileHeight, layout))
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_COMPRESSION_OPTIONS);
+    }
+
+    // stored rows are taken from the image one at a time, planes and tiles are never copied out of it
+    int rowsPerBand = options.bandChecksums && options.rowsPerBand > 0 ? options.rowsPerBand : 0;
+    std::vector<BYTE> rowFilters(options.rowFilters ? layout.rows : 0);
+    BYTE* filters = options.rowFilters ? rowFilters.data() : nullptr;
+    bool filtersChosen = false;
+
+    PayloadCoder coder;
+    coder.coding = options.payloadCoding;
+    coder.leftPrediction = options.leftPrediction;
+
+    // Huffman coding reads every row twice, once to count symbols and once to encode them
+    Progress tracker(callback, static_cast<uint64_t>(layout.rows) * (coder.coding == PayloadCoding::HUFFMAN ? 2 : 1));
+    Progress* progress = callback ? &tracker : nullptr;
+    std::vector<SymbolFrequencies> groupFrequencies;
+
+    if(coder.coding == PayloadCoding::HUFFMAN)
+    {
+        // the code needs every row before the first one is encoded, so it gets a pass of its own, which also chooses
+        // the filters. Segments are counted in a few groups, each with its own table
+        int groups = layout.segments < 64 ? layout.segments : 64;
+        groupFrequencies.resize(groups);
+        std::vector<CodecStats> groupStats(COUNTING_STATS ? groups : 0);
+
+        runInParallel(groups, [&](int group){
+            IMAGECOMPRESSOR_TRACE_SPAN("count symbols", group);
+
+            for(int index = group; index < layout.segments; index += groups)
+            {
+                Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+
+                forEachSegmentRow(data, options.planarChannels, segment, rowsPerBand, filters, false, taskStats(groupStats, group), progress,
+                                  [&](int, const BYTE*, const BYTE* row){
+                    countPayloadSymbols(row, segment.width, coder.leftPrediction, groupFrequencies[group]);
+                });
+            }
+        });
+
+        uint64_t frequencies[Detail::HUFFMAN_SYMBOLS] = {};
+
+        for(const SymbolFrequencies& group : groupFrequencies)
+        {
+            for(int symbol = 0; symbol < Detail::HUFFMAN_SYMBOLS; ++symbol)
+            {
+                frequencies[symbol] += group.counts[symbol];
+            }
+        }
+
+        for(const CodecStats& part : groupStats)
+        {
+            addStats(stats, part);
+        }
+
+        Detail::buildHuffmanCodeLengths(frequencies, coder.codeLengths);
+        Detail::buildHuffmanCodes(coder.codeLengths, coder.codes);
+        filtersChosen = true;
+    }
+
+    std::vector<BandInfo> bands(rowsPerBand ? (static_cast<size_t>(layout.rows) + rowsPerBand - 1) / rowsPerBand : 0);
+    std::vector<BinaryWriter> writers(layout.segments);
+
+    // with a group per segment the counts give the exact size of every segment's stream, so it is allocated once
+    for(int index = 0; index < static_cast<int>(groupFrequencies.size()) && groupFrequencies.size() == writers.size(); ++index)
+    {
+        uint64_t segmentBits = groupFrequencies[index].tokenBits;
+
+        for(int symbol = 0; symbol < Detail::HUFFMAN_SYMBOLS; ++symbol)
+        {
+            segmentBits += groupFrequencies[index].counts[symbol] * coder.codeLengths[symbol];
+        }
+
+        writers[index].reserveBits(segmentBits);
+    }
+    std::vector<std::vector<bool>> indexes(layout.segments);
+    std::vector<uint64_t> rowHashes(options.rowHashes ? layout.rows : 0);
+    std::vector<uint64_t> rowOffsets(options.rowHashes ? static_cast<size_t>(layout.rows) + 1 : 0);
+    std::vector<CodecStats> segmentStats(COUNTING_STATS ? layout.segments : 0);
+
+    runInParallel(layout.segments, [&](int index){
+        IMAGECOMPRESSOR_TRACE_SPAN("encode segment", index);
+        encodeSegment(data, options.planarChannels, layout, Detail::storedSegment(layout, index), rowsPerBand, coder, filters, filtersChosen,
+                      writers[index], indexes[index], bands, rowHashes, rowOffsets, taskStats(segmentStats, index), progress);
+    });
+
+    for(const CodecStats& part : segmentStats)
+    {
+        addStats(stats, part);
+    }
+
+    // bands across segments end in segments encoded by other threads, their rows are read again
+    std::vector<int> spanningBands;
+
+    for(int band = 0; band < static_cast<int>(bands.size()); ++band)
+    {
+        if(bandSpansSegments(layout, rowsPerBand, band))
+        {
+            spanningBands.push_back(band);
+        }
+    }
+
+    runInParallel(static_cast<int>(spanningBands.size()), [&](int i){
+        IMAGECOMPRESSOR_TRACE_SPAN("band checksum", spanningBands[i]);
+        int firstRow = spanningBands[i] * rowsPerBand;
+        int lastRow = layout.rows - firstRow < rowsPerBand ? layout.rows : firstRow + rowsPerBand;
+        bands[spanningBands[i]].checksum = storedRowsChecksum(data, options.planarChannels, layout, firstRow, lastRow);
+    });
+
+    // segments are joined into one stream, bands of later segments move by the size of the segments before them.
+    // Its size is known by now, so it is allocated once
+    BinaryWriter& binaryData = writers[0];
+    std::vector<uint64_t> segmentOffsets(1, 0);
+    uint64_t streamBits = 0;
+
+    for(const BinaryWriter& writer : writers)
+    {
+        streamBits += writer.bitCount();
+    }
+
+    binaryData.reserveBits(streamBits);
+
+    for(int index = 1; index < layout.segments; ++index)
+    {
+        Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+        uint64_t segmentOffset = binaryData.bitCount();
+        segmentOffsets.push_back(segmentOffset);
+
+        if(rowsPerBand)
+        {
+            size_t firstBand = (static_cast<size_t>(segment.firstRow) + rowsPerBand - 1) / rowsPerBand;
+            size_t lastBand = (static_cast<size_t>(segment.firstRow) + segment.height + rowsPerBand - 1) / rowsPerBand;
+
+            for(size_t band = firstBand; band < lastBand; ++band)
+            {
+                bands[band].bitOffset += segmentOffset;
+            }
+        }
+
+        for(int raw = 0; raw < segment.height && !rowOffsets.empty(); ++raw)
+        {
+            rowOffsets[segment.firstRow + raw] += segmentOffset;
+        }
+
+        binaryData.append(writers[index]);
+        indexes[0].insert(indexes[0].end(), indexes[index].begin(), indexes[index].end());
+        std::vector<bool>().swap(indexes[index]);
+    }
+
+    if(!rowOffsets.empty())
+    {
+        rowOffsets.back() = binaryData.bitCount();
+    }
+
+#ifdef IMAGECOMPRESSOR_STATS
+    for(const BinaryWriter& writer : writers)
+    {
+        IMAGECOMPRESSOR_ADD(stats, allocations, writer.allocations());
+    }
+#endif
+
+    CompressedImage compressed;
+    compressed.width = data.width;
+    compressed.height = data.height;
+    compressed.compressedIndexes = std::move(indexes[0]);
+    compressed.data = binaryData.takeData();
+    compressed.rowsPerBand = rowsPerBand;
+    compressed.bands = std::move(bands);
+    compressed.payloadCoding = coder.coding;
+    compressed.leftPrediction = coder.leftPrediction;
+    compressed.rowFilters = std::move(rowFilters);
+
+    if(coder.coding == PayloadCoding::HUFFMAN)
+    {
+        compressed.codeLengths.assign(coder.codeLengths, coder.codeLengths + Detail::HUFFMAN_SYMBOLS);
+    }
+
+    if(options.planarChannels != 0)
+    {
+        compressed.planarChannels = options.planarChannels;
+        compressed.pixelsPerRow = options.pixelsPerRow;
+    }
+
+    if(options.tileWidth != 0)
+    {
+        compressed.tileWidth = options.tileWidth;
+        compressed.tileHeight = options.tileHeight;
+    }
+
+    if(layout.segments > 1)
+    {
+        compressed.segmentOffsets = std::move(segmentOffsets);
+    }
+
+    compressed.rowHashes = std::move(rowHashes);
+    compressed.rowOffsets = std::move(rowOffsets);
+
+    stats.bytesIn = static_cast<uint64_t>(data.width) * static_cast<uint64_t>(data.height);
+    stats.bytesOut = compressed.data.size();
+
+    return compressed;
+}
+
+ImageCompressor::CodecStats ImageCompressor::estimateCompression(const RawImageData& data, const CompressionOptions& options)
+{
+    IMAGECOMPRESSOR_TRACE_SPAN("estimateCompression");
+    Detail::StoredLayout layout;
+
+    if(!Detail::storedLayout(data.width, data.height, options.planarChannels, options.pixelsPerRow, options.tileWidth, options.tileHeight, layout))
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_COMPRESSION_OPTIONS);
+    }
+
+    // the rows compressImage would encode, with the same filters, are only classified. The stream is a token per group,
+    // 1 bit for WHITE and 2 for the others, followed by the payload of DIFFERENT groups
+    int rowsPerBand = options.bandChecksums && options.rowsPerBand > 0 ? options.rowsPerBand : 0;
+    std::vector<BYTE> rowFilters(options.rowFilters ? layout.rows : 0);
+    BYTE* filters = options.rowFilters ? rowFilters.data() : nullptr;
+    bool huffman = options.payloadCoding == PayloadCoding::HUFFMAN;
+    int groups = layout.segments < 64 ? layout.segments : 64;
+    std::vector<SymbolFrequencies> groupFrequencies(groups);
+    std::vector<CodecStats> groupStats(groups);
+    std::vector<uint64_t> groupPayloadBits(groups, 0);
+
+    runInParallel(groups, [&](int group){
+        IMAGECOMPRESSOR_TRACE_SPAN("estimate segments", group);
+        CodecStats& counts = groupStats[group];
+        uint64_t& payloadBits = groupPayloadBits[group];
+        uint64_t (&frequencies)[Detail::HUFFMAN_SYMBOLS] = groupFrequencies[group].counts;
+
+        for(int index = group; index < layout.segments; index += groups)
+        {
+            Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+
+            forEachSegmentRow(data, options.planarChannels, segment, rowsPerBand, filters, false, nullptr, nullptr,
+                              [&](int, const BYTE*, const BYTE* row){
+                if(isEmptyRaw(row, row + segment.width))
+                {
+                    ++counts.emptyRows;
+                    return;
+                }
+
+                forEachGroup(row, segment.width, [&](int column, int groupSize, DataIdentifiers identifier){
+                    if(identifier == DataIdentifiers::WHITE_IN_RAW)
+                    {
+                        ++counts.whiteGroups;
+                    }
+                    else if(identifier == DataIdentifiers::BLACK_IN_RAW)
+                    {
+                        ++counts.blackGroups;
+                    }
+                    else
+                    {
+                        ++counts.differentGroups;
+
+                        // raw payload is 8 bits a byte, so only Huffman needs the bytes themselves
+                        for(int i = column; i < column + groupSize && huffman; ++i)
+                        {
+                            ++frequencies[payloadSymbol(row, i, options.leftPrediction)];
+                        }
+
+                        payloadBits += huffman ? 0 : 8 * static_cast<uint64_t>(groupSize);
+                    }
+                });
+            });
+        }
+    });
+
+    CodecStats stats;
+    uint64_t frequencies[Detail::HUFFMAN_SYMBOLS] = {};
+    uint64_t payloadBits = 0;
+
+    for(int group = 0; group < groups; ++group)
+    {
+        addStats(stats, groupStats[group]);
+        payloadBits += groupPayloadBits[group];
+
+        for(int symbol = 0; symbol < Detail::HUFFMAN_SYMBOLS; ++symbol)
+        {
+            frequencies[symbol] += groupFrequencies[group].counts[symbol];
+        }
+    }
+
+    if(huffman)
+    {
+        BYTE codeLengths[Detail::HUFFMAN_SYMBOLS];
+        Detail::buildHuffmanCodeLengths(frequencies, codeLengths);
+
+        for(int symbol = 0; symbol < Detail::HUFFMAN_SYMBOLS; ++symbol)
+        {
+            payloadBits += frequencies[symbol] * codeLengths[symbol];
+        }
+    }
+
+    uint64_t streamBits = stats.whiteGroups + 2 * (stats.blackGroups + stats.differentGroups) + payloadBits;
+    stats.bytesIn = static_cast<uint64_t>(data.width) * static_cast<uint64_t>(data.height);
+    stats.bytesOut = (streamBits + 7) / 8;
+
+    return stats;
+}
+
+bool ImageCompressor::compressedWith(const CompressedImage& image, const CompressionOptions& options)
+{
+    // options which don't change the stream, such as pixelsPerRow of an image which isn't planar, are left out
+    int rowsPerBand = options.bandChecksums && options.rowsPerBand > 0 ? options.rowsPerBand : 0;
+    int pixelsPerRow = options.planarChannels != 0 ? options.pixelsPerRow : 0;
+    int tileHeight = options.tileWidth != 0 ? options.tileHeight : 0;
+
+    return image.rowsPerBand == rowsPerBand && image.payloadCoding == options.payloadCoding && image.leftPrediction == options.leftPrediction
+            && image.rowFilters.empty() != options.rowFilters && image.planarChannels == options.planarChannels
+            && image.pixelsPerRow == pixelsPerRow && image.tileWidth == options.tileWidth && image.tileHeight == tileHeight;
+}
+
+ImageCompressor::CompressedImage ImageCompressor::recompressImage(const RawImageData& data, const CompressionOptions& options,
+                                                                  const CompressedImage& previous)
+{
+    return recompressImage(data, options, previous, ProgressCallback());
+}
+
+ImageCompressor::CompressedImage ImageCompressor::recompressImage(const RawImageData& data, const CompressionOptions& imageOptions,
+                                                                  const CompressedImage& previous, const ProgressCallback& callback)
+{
+    IMAGECOMPRESSOR_TRACE_SPAN("recompressImage");
+    CompressionOptions options = imageOptions;
+    options.rowHashes = true;
+    Detail::StoredLayout layout;
+
+    if(!Detail::storedLayout(data.width, data.height, options.planarChannels, options.pixelsPerRow, options.tileWidth, options.tileHeight, layout))
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_COMPRESSION_OPTIONS);
+    }
+
+    CodecStats fallbackStats;
+
+    // rows of previous are only taken over into a stream of the same options, a resized image or new options start anew
+    if(!compressedWith(previous, options) || !canRecompress(previous, data, layout))
+    {
+        return compressImage(data, options, fallbackStats, callback);
+    }
+
+    // every row is hashed, then encoded or copied
+    int channels = options.planarChannels;
+    std::vector<uint64_t> rowHashes(layout.rows);
+    Progress tracker(callback, static_cast<uint64_t>(layout.rows) * 2);
+    Progress* progress = callback ? &tracker : nullptr;
+
+    runInParallel(layout.segments, [&](int index){
+        IMAGECOMPRESSOR_TRACE_SPAN("hash rows", index);
+        Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+        std::vector<BYTE> buffer(channels != 0 ? segment.width : 0);
+
+        for(int raw = 0; raw < segment.height; ++raw)
+        {
+            rowHashes[segment.firstRow + raw] = xxhash64(gatherStoredRow(data, channels, segment, raw, buffer.data()), segment.width);
+            rowDone(progress, raw, segment.height);
+        }
+    });
+
+    PayloadCoder coder;
+    coder.coding = previous.payloadCoding;
+    coder.leftPrediction = previous.leftPrediction;
+
+    if(coder.coding == PayloadCoding::HUFFMAN)
+    {
+        std::copy(previous.codeLengths.begin(), previous.codeLengths.end(), coder.codeLengths);
+
+        if(!Detail::buildHuffmanCodes(coder.codeLengths, coder.codes))
+        {
+            return compressImage(data, options, fallbackStats, callback);
+        }
+    }
+
+    // everything but the stream and the row index is taken over and updated for the changed rows
+    CompressedImage compressed;
+    compressed.width = previous.width;
+    compressed.height = previous.height;
+    compressed.compressedIndexes = previous.compressedIndexes;
+    compressed.rowsPerBand = previous.rowsPerBand;
+    compressed.bands = previous.bands;
+    compressed.payloadCoding = previous.payloadCoding;
+    compressed.leftPrediction = previous.leftPrediction;
+    compressed.codeLengths = previous.codeLengths;
+    compressed.rowFilters = previous.rowFilters;
+    compressed.planarChannels = previous.planarChannels;
+    compressed.pixelsPerRow = previous.pixelsPerRow;
+    compressed.tileWidth = previous.tileWidth;
+    compressed.tileHeight = previous.tileHeight;
+    compressed.rowOffsets.resize(static_cast<size_t>(layout.rows) + 1);
+
+    bool filtered = !previous.rowFilters.empty();
+    int rowsPerBand = previous.rowsPerBand;
+    std::vector<BYTE> rowBuffer(channels != 0 ? layout.tileWidth : 0);
+    std::vector<BYTE> prevBuffer(channels != 0 ? layout.tileWidth : 0);
+    std::vector<BYTE> filteredRow(layout.tileWidth);
+    std::vector<BYTE> scratch(layout.tileWidth);
+    std::vector<char> changedBands(previous.bands.size(), 0);
+
+    // unchanged rows follow each other in previous data, so every run of them is copied at once
+    BinaryWriter binaryData;
+    uint64_t copyOffset = 0;
+    uint64_t copyBits = 0;
+
+    for(int index = 0; index < layout.segments; ++index)
+    {
+        Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+
+        for(int raw = 0; raw < segment.height; ++raw)
+        {
+            int storedRow = segment.firstRow + raw;
+            uint64_t position = binaryData.bitCount() + copyBits;
+            bool changed = rowHashes[storedRow] != previous.rowHashes[storedRow];
+
+            // a filtered row is predicted from the row above it, so it changes with it
+            bool prevChanged = filtered && filterUsesPrevRow(segment, rowsPerBand, raw) && rowHashes[storedRow - 1] != previous.rowHashes[storedRow - 1];
+
+            if(raw == 0)
+            {
+                compressed.segmentOffsets.push_back(position);
+            }
+
+            if(rowsPerBand && storedRow % rowsPerBand == 0)
+            {
+                compressed.bands[storedRow / rowsPerBand].bitOffset = position;
+            }
+
+            if(rowsPerBand && changed)
+            {
+                changedBands[storedRow / rowsPerBand] = 1;
+            }
+
+            compressed.rowOffsets[storedRow] = position;
+
+            if(!changed && !prevChanged)
+            {
+                if(copyBits == 0)
+                {
+                    copyOffset = previous.rowOffsets[storedRow];
+                }
+
+                copyBits += previous.rowOffsets[storedRow + 1] - previous.rowOffsets[storedRow];
+                rowDone(progress, raw, segment.height);
+                continue;
+            }
+
+            binaryData.appendBits(previous.data.data(), copyOffset, copyBits);
+            copyBits = 0;
+
+            const BYTE* row = gatherStoredRow(data, channels, segment, raw, rowBuffer.data());
+
+            if(filtered)
+            {
+                // without the row above only NONE and SUB are used, they don't read it
+                bool usePrev = filterUsesPrevRow(segment, rowsPerBand, raw);
+                const BYTE* prev = usePrev ? gatherStoredRow(data, channels, segment, raw - 1, prevBuffer.data()) : row;
+                Detail::RowFilter filter = Detail::filterRowAdaptive(row, prev, filteredRow.data(), scratch.data(), segment.width, usePrev);
+                compressed.rowFilters[storedRow] = static_cast<BYTE>(filter);
+                row = filteredRow.data();
+            }
+
+            bool emptyRaw = isEmptyRaw(row, row + segment.width);
+            compressed.compressedIndexes[storedRow] = emptyRaw;
+
+            if(!emptyRaw)
+            {
+                encodeRow(row, segment.width, binaryData, coder, nullptr);
+            }
+
+            rowDone(progress, raw, segment.height);
+        }
+    }
+
+    binaryData.appendBits(previous.data.data(), copyOffset, copyBits);
+    compressed.rowOffsets.back() = binaryData.bitCount();
+    compressed.data = binaryData.takeData();
+    compressed.rowHashes = std::move(rowHashes);
+
+    if(layout.segments == 1)
+    {
+        compressed.segmentOffsets.clear();
+    }
+
+    for(size_t band = 0; band < changedBands.size(); ++band)
+    {
+        if(changedBands[band])
+        {
+            int firstRow = static_cast<int>(band) * rowsPerBand;
+            int lastRow = layout.rows - firstRow < rowsPerBand ? layout.rows : firstRow + rowsPerBand;
+            compressed.bands[band].checksum = storedRowsChecksum(data, channels, layout, firstRow, lastRow);
+        }
+    }
+
+    return compressed;
+}
+
+ImageCompressor::RawImageData ImageCompressor::decompressImage(const CompressedImage& data)
+{
+    return decodeImage(data, nullptr, ProgressCallback());
+}
+
+ImageCompressor::RawImageData ImageCompressor::decompressImage(const CompressedImage& data, DecompressionReport& report)
+{
+    return decompressImage(data, report, ProgressCallback());
+}
+
+ImageCompressor::RawImageData ImageCompressor::decompressImage(const CompressedImage& data, DecompressionReport& report,
+                                                               const ProgressCallback& callback)
+{
+    StatsTimer timer(report.stats);
+    report.stats.bytesIn = data.data.size();
+    report.stats.bytesOut = static_cast<uint64_t>(data.width) * static_cast<uint64_t>(data.height);
+
+    if(data.rowsPerBand <= 0)
+    {
+        return decodeImage(data, &report.stats, callback);
+    }
+
+    IMAGECOMPRESSOR_TRACE_SPAN("decompressImage");
+    PayloadCoder coder;
+    Detail::StoredLayout layout;
+    std::unique_ptr<Detail::HuffmanDecodeTable> table(new Detail::HuffmanDecodeTable());
+    prepareDecoder(data, layout, *table, coder);
+
+    size_t bandsCount = (static_cast<size_t>(layout.rows) + data.rowsPerBand - 1) / data.rowsPerBand;
+
+    if(data.bands.size() != bandsCount)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
+    }
+
+    // every band starts at a known offset and its first row doesn't depend on the row above, so bands are decoded and
+    // checked in parallel, whichever tiles and planes they cover
+    std::unique_ptr<BYTE[]> pixels = allocateImage(data);
+    size_t rowBufferSize = data.planarChannels != 0 ? 2 * static_cast<size_t>(layout.tileWidth) : 0;
+    std::vector<char> bandCorrupted(bandsCount, 0);
+    std::vector<CodecStats> bandStats(COUNTING_STATS ? bandsCount : 0);
+    std::unique_ptr<RowLocks> rowLocks(layout.planes > 1 ? new RowLocks() : nullptr);
+    Progress tracker(callback, static_cast<uint64_t>(layout.rows));
+    Progress* progress = callback ? &tracker : nullptr;
+    IMAGECOMPRESSOR_ADD(report.stats, allocations, 1);
+
+    runInParallel(static_cast<int>(bandsCount), [&](int band){
+        IMAGECOMPRESSOR_TRACE_SPAN("decode band", band);
+        int firstRow = band * data.rowsPerBand;
+        int lastRow = layout.rows - firstRow < data.rowsPerBand ? layout.rows : firstRow + data.rowsPerBand;
+        uint32_t checksum = 0;
+        std::vector<BYTE> rowBuffer(rowBufferSize);
+        BinaryReader reader(data.data);
+        IMAGECOMPRESSOR_COUNT(taskStats(bandStats, band), allocations, rowBufferSize != 0 ? 1 : 0);
+
+        reader.seek(data.bands[band].bitOffset);
+
+        if(!decodeStoredRows(data, layout, reader, coder, firstRow, lastRow, pixels.get(), rowBuffer.data(), &checksum, taskStats(bandStats, band),
+                             progress, rowLocks.get()))
+        {
+            fillStoredRows(data, layout, firstRow, lastRow, pixels.get(), rowLocks.get());
+            bandCorrupted[band] = 1;
+        }
+        else
+        {
+            bandCorrupted[band] = checksum != data.bands[band].checksum;
+        }
+    });
+
+    for(size_t band = 0; band < bandsCount; ++band)
+    {
+        if(bandCorrupted[band])
+        {
+            report.corruptedBands.push_back(static_cast<int>(band));
+        }
+    }
+
+    for(const CodecStats& part : bandStats)
+    {
+        addStats(report.stats, part);
+    }
+
+    return makeImage(data, std::move(pixels));
+}
+
+ImageCompressor::RawImageData ImageCompressor::decompressRegion(const CompressedImage& data, const ImageRegion& region)
+{
+    IMAGECOMPRESSOR_TRACE_SPAN("decompressRegion");
+    PayloadCoder coder;
+    Detail::StoredLayout layout;
+    std::unique_ptr<Detail::HuffmanDecodeTable> table(new Detail::HuffmanDecodeTable());
+    prepareDecoder(data, layout, *table, coder);
+
+    if(region.width <= 0 || region.height <= 0 || region.x < 0 || region.y < 0
+            || region.x > layout.width - region.width || region.y > layout.height - region.height)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_REGION);
+    }
+
+    int channels = data.planarChannels != 0 ? data.planarChannels : 1;
+    size_t regionSize = static_cast<size_t>(region.width) * region.height;
+
+    RawImageData imageData;
+    imageData.width = region.width * channels;
+    imageData.height = region.height;
+
+    if(layout.segments > 1 && data.segmentOffsets.empty())
+    {
+        // without segment offsets a tile can't be found without decoding everything before it
+        RawImageData image = decompressImage(data);
+        std::unique_ptr<BYTE[]> pixels(image.data);
+        std::unique_ptr<BYTE[]> regionData(new BYTE[regionSize * channels]);
+
+        for(int raw = 0; raw < region.height; ++raw)
+        {
+            memcpy(regionData.get() + static_cast<size_t>(raw) * imageData.width,
+                   pixels.get() + static_cast<size_t>(region.y + raw) * data.width + static_cast<size_t>(region.x) * channels, imageData.width);
+        }
+
+        imageData.data = regionData.release();
+        return imageData;
+    }
+
+    // tiles which intersect the region in every plane
+    std::vector<int> segments;
+    int firstTileX = region.x / layout.tileWidth;
+    int lastTileX = (region.x + region.width - 1) / layout.tileWidth;
+    int firstTileY = region.y / layout.tileHeight;
+    int lastTileY = (region.y + region.height - 1) / layout.tileHeight;
+
+    for(int plane = 0; plane < layout.planes; ++plane)
+    {
+        for(int tileY = firstTileY; tileY <= lastTileY; ++tileY)
+        {
+            for(int tileX = firstTileX; tileX <= lastTileX; ++tileX)
+            {
+                segments.push_back((plane * layout.tilesY + tileY) * layout.tilesX + tileX);
+            }
+        }
+    }
+
+    // region of every plane, one after another
+    std::unique_ptr<BYTE[]> planes(new BYTE[regionSize * channels]);
+    std::vector<char> segmentDecoded(segments.size(), 0);
+
+    runInParallel(static_cast<int>(segments.size()), [&](int i){
+        IMAGECOMPRESSOR_TRACE_SPAN("decode segment", segments[i]);
+        Detail::StoredSegment segment = Detail::storedSegment(layout, segments[i]);
+
+        // rows of a segment can only be decoded from its first one, only two of them are held at a time
+        int regionBottom = region.y + region.height;
+        int rows = regionBottom - segment.y < segment.height ? regionBottom - segment.y : segment.height;
+        std::vector<BYTE> rowBuffer(2 * static_cast<size_t>(segment.width));
+
+        BinaryReader reader(data.data);
+        reader.seek(layout.segments > 1 ? data.segmentOffsets[segments[i]] : 0);
+
+        int left = region.x > segment.x ? region.x : segment.x;
+        int right = region.x + region.width < segment.x + segment.width ? region.x + region.width : segment.x + segment.width;
+        int top = region.y > segment.y ? region.y : segment.y;
+        BYTE* plane = planes.get() + static_cast<size_t>(segment.plane) * regionSize;
+
+        for(int raw = 0; raw < rows; ++raw)
+        {
+            BYTE* row = rowBuffer.data() + (raw % 2) * static_cast<size_t>(segment.width);
+            const BYTE* prev = rowBuffer.data() + ((raw + 1) % 2) * static_cast<size_t>(segment.width);
+            int y = segment.y + raw;
+
+            if(!decodeSegmentRow(data, segment, reader, coder, raw, row, prev))
+            {
+                return;
+            }
+
+            if(y >= top)
+            {
+                memcpy(plane + static_cast<size_t>(y - region.y) * region.width + (left - region.x), row + (left - segment.x), right - left);
+            }
+        }
+
+        segmentDecoded[i] = 1;
+    });
+
+    for(char segmentResult : segmentDecoded)
+    {
+        if(!segmentResult)
+        {
+            throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
+        }
+    }
+
+    if(data.planarChannels != 0)
+    {
+        std::unique_ptr<BYTE[]> pixels(new BYTE[regionSize * channels]);
+        Detail::interleaveRows(planes.get(), channels, region.width, region.height, pixels.get(), imageData.width);
+        planes = std::move(pixels);
+    }
+
+    imageData.data = planes.release();
+    return imageData;
+}
+
+ImageCompressor::RawImageData ImageCompressor::decompressPreview(const CompressedImage& data, int scale)
+{
+    if(scale != 2 && scale != 4 && scale != 8)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_PREVIEW_SCALE);
+    }
+
+    IMAGECOMPRESSOR_TRACE_SPAN("decompressPreview");
+    PayloadCoder coder;
+    Detail::StoredLayout layout;
+    std::unique_ptr<Detail::HuffmanDecodeTable> table(new Detail::HuffmanDecodeTable());
+    prepareDecoder(data, layout, *table, coder);
+
+    int channels = data.planarChannels != 0 ? data.planarChannels : 1;
+    int previewWidth = (layout.width + scale - 1) / scale;
+    int previewHeight = (layout.height + scale - 1) / scale;
+    size_t planeSize = static_cast<size_t>(previewWidth) * previewHeight;
+
+    std::unique_ptr<BYTE[]> planes(new BYTE[planeSize * channels]);
+    bool decoded = true;
+    // rows which aren't sampled are skipped by their offset in the row index, if the image has one
+    bool indexed = data.rowOffsets.size() == static_cast<size_t>(layout.rows) + 1;
+
+    if(layout.segments > 1 && !data.segmentOffsets.empty())
+    {
+        std::vector<char> segmentDecoded(layout.segments, 0);
+
+        runInParallel(layout.segments, [&](int index){
+            IMAGECOMPRESSOR_TRACE_SPAN("decode segment", index);
+            Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+            BinaryReader reader(data.data);
+            reader.seek(data.segmentOffsets[index]);
+            segmentDecoded[index] = decodeSegmentPreview(data, segment, reader, coder, indexed, scale, previewWidth,
+                                                         planes.get() + segment.plane * planeSize);
+        });
+
+        for(char segmentResult : segmentDecoded)
+        {
+            decoded = decoded && segmentResult;
+        }
+    }
+    else
+    {
+        // segments follow each other in the stream
+        BinaryReader reader(data.data);
+
+        for(int index = 0; index < layout.segments && decoded; ++index)
+        {
+            Detail::StoredSegment segment = Detail::storedSegment(layout, index);
+            decoded = decodeSegmentPreview(data, segment, reader, coder, indexed, scale, previewWidth, planes.get() + segment.plane * planeSize);
+        }
+    }
+
+    if(!decoded)
+    {
+        throw ImageCompressorException(ExceptionType::INCORRECT_DATA_IN_DECOMPRESSION);
+    }
+
+    RawImageData imageData;
+    imageData.width = previewWidth * channels;
+    imageData.height = previewHeight;
+
+    if(data.planarChannels != 0)
+    {
+        std::unique_ptr<BYTE[]> pixels(new BYTE[planeSize * channels]);
+        Detail::interleaveRows(planes.get(), channels, previewWidth, previewHeight, pixels.get(), imageData.width);
+        planes = std::move(pixels);
+    }
+
+    imageData.data = planes.release();
+    return imageData;
+}
+
+std::vector<ImageCompressor::BandArea> ImageCompressor::bandAreas(const CompressedImage& data, int band)
+{
+    std::vector<BandArea> areas;
+    Detail::StoredLayout layout;
+
+    if(data.rowsPerBand <= 0 || band < 0
+            || !Detail::storedLayout(data.width, data.height, data.planarChannels, data.pixelsPerRow, data.tileWidth, data.tileHeight, layout)
+            || static_cast<int64_t>(band) * data.rowsPerBand >= layout.rows)
+    {
+        return areas;
+    }
+
+    // the last band ends with the last stored row, every segment it crosses is an area of its own
+    int firstRow = band * data.rowsPerBand;
+    int lastRow = layout.rows - firstRow < data.rowsPerBand ? layout.rows : firstRow + data.rowsPerBand;
+
+    while(firstRow < lastRow)
+    {
+        Detail::StoredSegment segment = Detail::storedSegment(layout, Detail::storedSegmentOfRow(layout, firstRow));
+        int segmentEnd = segment.firstRow + segment.height < lastRow ? segment.firstRow + segment.height : lastRow;
+
+        BandArea area;
+        area.plane = segment.plane;
+        area.region.x = segment.x;
+        area.region.y = segment.y + firstRow - segment.firstRow;
+        area.region.width = segment.width;
+        area.region.height = segmentEnd - firstRow;
+        areas.push_back(area);
+
+        firstRow = segmentEnd;
+    }
+
+    return areas;
+}
+
+bool ImageCompressor::Detail::checkTokenStream(const TokenStreamView& view)
+{
+    PayloadCoder coder;
+    HuffmanDecodeTable table;
+
+    try
+    {
+        preparePayloadDecoder(view.payloadCoding, false, view.codeLengths, table, coder);
+    }
+    catch(const ImageCompressorException&)
+    {
+        return false;
+    }
+
+    BinaryReader reader(view.data, view.size);
+    const StoredLayout& layout = view.layout;
+
+    auto offsetMatches = [&reader](const BYTE* offsets, size_t index) {
+        uint64_t offset = 0;
+        memcpy(&offset, offsets + index * sizeof(uint64_t), sizeof(uint64_t));
+        return offset == reader.tell();
+    };
+
+    for(int index = 0; index < layout.segments; ++index)
+    {
+        StoredSegment segment = storedSegment(layout, index);
+
+        if(view.segmentOffsets && !offsetMatches(view.segmentOffsets, index))
+        {
+            return false;
+        }
+
+        for(int raw = segment.firstRow; raw < segment.firstRow + segment.height; ++raw)
+        {
+            if(view.bands && view.rowsPerBand > 0 && raw % view.rowsPerBand == 0)
+            {
+                uint64_t bandOffset = 0;
+                memcpy(&bandOffset, view.bands + (raw / view.rowsPerBand) * (sizeof(uint64_t) + sizeof(uint32_t)), sizeof(uint64_t));
+
+                if(bandOffset != reader.tell())
+                {
+                    return false;
+                }
+            }
+
+            if(view.rowOffsets && !offsetMatches(view.rowOffsets, raw))
+            {
+                return false;
+            }
+
+            // first rows of segments and bands are decoded on their own, so they can only be filtered by the left byte
+            bool firstRow = raw == segment.firstRow || (view.rowsPerBand > 0 && raw % view.rowsPerBand == 0);
+
+            if(view.rowFilters && (view.rowFilters[raw] >= ROW_FILTERS_COUNT
+                                   || (firstRow && view.rowFilters[raw] > static_cast<BYTE>(RowFilter::SUB))))
+            {
+                return false;
+            }
+
+            bool emptyRaw = view.packedRowFlags ? ((view.rowFlags[raw / 8] >> (7 - raw % 8)) & 0x01) != 0 : view.rowFlags[raw] != 0;
+
+            if(!emptyRaw && !decodeRow<false>(reader, nullptr, segment.width, coder))
+            {
+                return false;
+            }
+        }
+    }
+
+    if(view.rowOffsets && !offsetMatches(view.rowOffsets, layout.rows))
+    {
+        return false;
+    }
+
+    return (reader.tell() + 7) / 8 == view.size;
 }
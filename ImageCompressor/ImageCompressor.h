@@ -1,8 +1,11 @@
 #ifndef IMAGECOMPRESSOR_H
 #define IMAGECOMPRESSOR_H
 
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <string>
 
 namespace ImageCompressor
 {
@@ -14,26 +17,128 @@ namespace ImageCompressor
         unsigned char *data = nullptr; // Pointer to image data. data[j * width + i] is color of pixel in row j and column i.
     };
 
+    struct BandInfo
+    {
+        uint64_t bitOffset = 0; // position of the band's first token in CompressedImage::data
+        uint32_t checksum = 0; // CRC32C of the band's decompressed bytes
+    };
+
+    // How bytes of DIFFERENT groups are stored.
+    enum class PayloadCoding
+    {
+        RAW = 0, // 8 bits per byte
+        HUFFMAN // static Huffman code built for the image, decoding stays within 2x of RAW
+    };
+
     struct CompressedImage
     {
         int width = 0; // image width in pixels
         int height = 0; // image height in pixels
         std::vector<bool> compressedIndexes;
         std::vector<BYTE> data;
+        int rowsPerBand = 0; // height of a checksummed band of rows, 0 if the image has no bands
+        std::vector<BandInfo> bands;
+        PayloadCoding payloadCoding = PayloadCoding::RAW;
+        bool leftPrediction = false; // DIFFERENT bytes are stored as difference to the pixel on the left
+        std::vector<BYTE> codeLengths; // Huffman code length of every byte value when payloadCoding is HUFFMAN
+        std::vector<BYTE> rowFilters; // filter of every row (NONE, SUB, UP, AVERAGE, PAETH), empty if rows are not filtered
+        // Planar images keep width as bytes per line, but their rows are stored as planarChannels planes
+        // of pixelsPerRow x height bytes one after another. Tiled images store every tile of a plane
+        // row by row, tiles go left to right, top to bottom. compressedIndexes, rowFilters and bands
+        // cover these stored rows.
+        int planarChannels = 0; // 0 if bytes are stored as they are
+        int pixelsPerRow = 0;
+        int tileWidth = 0; // 0 if the image isn't tiled
+        int tileHeight = 0;
+        std::vector<uint64_t> segmentOffsets; // position of the first token of every tile (or plane) in data
+        // XXH64 of every stored row before filtering and the position of its first token in data, with the end
+        // of the last row at the back, so recompressImage can find the rows which changed. Empty if not stored.
+        std::vector<uint64_t> rowHashes;
+        std::vector<uint64_t> rowOffsets;
+    };
+
+    // Rectangle of an image. x and width are in pixels for planar images and in bytes otherwise.
+    struct ImageRegion
+    {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    struct CompressionOptions
+    {
+        bool bandChecksums = false; // store start offset and CRC32C of every band of rows
+        int rowsPerBand = 64;
+        PayloadCoding payloadCoding = PayloadCoding::RAW;
+        bool leftPrediction = false; // store DIFFERENT bytes as difference to the pixel on the left
+        // PNG-style filter chosen for every row before the token stage. Meant for gradients and photos,
+        // which never produce WHITE or BLACK groups as they are. First rows of bands are filtered
+        // without the previous row, so every band still decodes on its own.
+        bool rowFilters = false;
+        // Interleaved pixels of planarChannels (2 to 4) bytes, e.g. BGR or BGRA, are split into one plane
+        // per channel, so white paper gives WHITE groups in every plane. Planes are encoded in parallel.
+        // Bytes of a row after pixelsPerRow * planarChannels are padding and decompress as zeros.
+        int planarChannels = 0;
+        int pixelsPerRow = 0;
+        // Splits every plane into tiles which are encoded and decoded independently and in parallel,
+        // so a region can be decoded without the rest of its rows. 0 keeps whole rows.
+        int tileWidth = 0;
+        int tileHeight = 0;
+        bool rowHashes = false; // store a hash and the position of every row for recompressImage
+    };
+
+    // Counters of one compression or decompression. Only bytesIn and bytesOut are kept unless the library is
+    // built with IMAGECOMPRESSOR_STATS, without it the codec has no counting code at all.
+    struct CodecStats
+    {
+        uint64_t bytesIn = 0; // image bytes for compression, stream bytes for decompression
+        uint64_t bytesOut = 0;
+        double seconds = 0; // time spent in the call
+        uint64_t emptyRows = 0;
+        uint64_t whiteGroups = 0;
+        uint64_t blackGroups = 0;
+        uint64_t differentGroups = 0;
+        uint64_t allocations = 0; // stream and row buffers the codec allocated or grew
+    };
+
+    // Called with the rows done so far out of total, every few dozen rows of each thread but by one thread at a time.
+    // Returning false cancels the call: its buffers are freed and it throws ExceptionType::CANCELLED.
+    using ProgressCallback = std::function<bool(uint64_t done, uint64_t total)>;
+
+    // Part of one plane which a band of stored rows covers. A band of a planar or tiled image may cover parts of several
+    // planes or tiles.
+    struct BandArea
+    {
+        int plane = 0; // channel of planar images, 0 for the rest
+        ImageRegion region; // x and width are pixels of the plane
+    };
+
+    struct DecompressionReport
+    {
+        std::vector<int> corruptedBands; // bands whose data didn't match the checksum
+        CodecStats stats;
     };
 
     enum class ExceptionType
     {
-        INCORRECT_DATA_IN_DECOMPRESSION = 0
+        INCORRECT_DATA_IN_DECOMPRESSION = 0,
+        INCORRECT_FILE_DATA,
+        FILE_ACCESS_ERROR,
+        ARCHIVE_ENTRY_NOT_FOUND,
+        ARCHIVE_ENTRY_EXISTS,
+        INCORRECT_COMPRESSION_OPTIONS,
+        INCORRECT_REGION,
+        INCORRECT_PREVIEW_SCALE,
+        CANCELLED
     };
 
     class ImageCompressorException : public std::exception
     {
     public:
-        ImageCompressorException(ExceptionType type) : exceptionType{type} {}
-        const char* what() const _GLIBCXX_USE_NOEXCEPT override
+        ImageCompressorException(ExceptionType type) : exceptionType{type}
         {
-            std::string exceptionData{"Exception on "};
+            exceptionData = "Exception on ";
 
             switch(exceptionType)
             {
@@ -42,16 +147,98 @@ namespace ImageCompressor
             exceptionData+= "decompression. Incorrect size of compressing data.";
             break;
             }
+            case ExceptionType::INCORRECT_FILE_DATA:
+            {
+            exceptionData+= "reading. Incorrect .barch file data.";
+            break;
             }
-
+            case ExceptionType::FILE_ACCESS_ERROR:
+            {
+            exceptionData+= "file access. File can't be opened, read or written.";
+            break;
+            }
+            case ExceptionType::ARCHIVE_ENTRY_NOT_FOUND:
+            {
+            exceptionData+= "archive lookup. No entry with such name.";
+            break;
+            }
+            case ExceptionType::ARCHIVE_ENTRY_EXISTS:
+            {
+            exceptionData+= "archive append. Entry with such name already exists.";
+            break;
+            }
+            case ExceptionType::INCORRECT_COMPRESSION_OPTIONS:
+            {
+            exceptionData+= "compression. Options don't match the image.";
+            break;
+            }
+            case ExceptionType::INCORRECT_REGION:
+            {
+            exceptionData+= "region decompression. Region is empty or outside of the image.";
+            break;
+            }
+            case ExceptionType::INCORRECT_PREVIEW_SCALE:
+            {
+            exceptionData+= "preview decompression. Scale must be 2, 4 or 8.";
+            break;
+            }
+            case ExceptionType::CANCELLED:
+            {
+            exceptionData+= "compression or decompression. Cancelled by its progress callback.";
+            break;
+            }
+            }
+        }
+        const char* what() const _GLIBCXX_USE_NOEXCEPT override
+        {
             return exceptionData.c_str();
         }
+        ExceptionType type() const {return exceptionType;}
     private:
         ExceptionType exceptionType;
+        std::string exceptionData;
     };
 
-    CompressedImage compressImage(const RawImageData data);
-    RawImageData decompressImage(const CompressedImage data);
+    // Images may be larger than 4 GB, every size and position made of width and height is 64-bit. Stored rows are
+    // taken from data and decoded into the result one at a time, so apart from data and the result only a few rows
+    // per thread are held.
+    CompressedImage compressImage(const RawImageData& data);
+    CompressedImage compressImage(const RawImageData& data, const CompressionOptions& options);
+    CompressedImage compressImage(const RawImageData& data, const CompressionOptions& options, CodecStats& stats);
+    CompressedImage compressImage(const RawImageData& data, const CompressionOptions& options, CodecStats& stats,
+                                  const ProgressCallback& progress);
+    // Size compressImage would give with the same options, counted without writing the stream in one pass over the
+    // image. bytesOut is the exact size of CompressedImage::data; the token counters are filled whether or not the
+    // library is built with IMAGECOMPRESSOR_STATS, seconds and allocations are left at zero.
+    CodecStats estimateCompression(const RawImageData& data, const CompressionOptions& options);
+    // True if image was compressed with options, as far as they change the stream. Row hashes aren't compared.
+    bool compressedWith(const CompressedImage& image, const CompressionOptions& options);
+    // Compresses an edited version of previous with options, the result always has row hashes. Only rows whose hash
+    // changed are encoded again (and the rows below them when rows are filtered), the rest of the stream is copied
+    // from previous. Falls back to compressImage when previous was compressed with other options or has no row hashes,
+    // the size changed or its Huffman table doesn't give every byte a code.
+    CompressedImage recompressImage(const RawImageData& data, const CompressionOptions& options, const CompressedImage& previous);
+    CompressedImage recompressImage(const RawImageData& data, const CompressionOptions& options, const CompressedImage& previous,
+                                    const ProgressCallback& progress);
+    RawImageData decompressImage(const CompressedImage& data);
+    // Verifies band checksums when the image has them. Corrupted bands are listed in the report
+    // instead of failing the whole image, bands which can't be decoded at all are filled with white.
+    RawImageData decompressImage(const CompressedImage& data, DecompressionReport& report);
+    RawImageData decompressImage(const CompressedImage& data, DecompressionReport& report, const ProgressCallback& progress);
+    // Decodes only the tiles which intersect region and returns the region alone, region.width * planarChannels
+    // bytes per row for planar images. Images which aren't tiled decode every row down to the region's bottom.
+    RawImageData decompressRegion(const CompressedImage& data, const ImageRegion& region);
+    // Decodes every scale-th row and column (scale is 2, 4 or 8) straight from the stream for thumbnails.
+    // WHITE or BLACK groups are never expanded. Columns are pixels for planar images and bytes otherwise, so the
+    // preview is (width / scale) * planarChannels bytes wide. With row hashes (the row index) rows which aren't
+    // sampled are skipped by their offset, filtered images decode the rows above a sampled one back to a row which
+    // doesn't use the row above. Without the index every token is still walked: for RAW payload that skips
+    // DIFFERENT bytes by their bit count, but HUFFMAN has to decode every symbol, so the preview costs nearly as much
+    // as a full decode.
+    RawImageData decompressPreview(const CompressedImage& data, int scale);
+    // Parts of the image which band of data covers, in stored order, e.g. to show the rows of a corrupted band of a
+    // DecompressionReport. Empty if data has no such band.
+    std::vector<BandArea> bandAreas(const CompressedImage& data, int band);
 };
 
 #endif // IMAGECOMPRESSOR_H
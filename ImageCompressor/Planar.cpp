@@ -0,0 +1,311 @@
+#include "Planar.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMAGECOMPRESSOR_PLANAR_SSSE3
+#include <tmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(IMAGECOMPRESSOR_PLANAR_SSSE3) && defined(__GNUC__)
+#define IMAGECOMPRESSOR_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define IMAGECOMPRESSOR_TARGET_SSSE3
+#endif
+
+using namespace::ImageCompressor;
+
+namespace
+{
+const int MAX_CHANNELS = 4;
+
+// pixels [first, pixels) of one row, planes are the rows of every plane
+void interleaveRowScalar(const BYTE* const* planes, int channels, int first, int pixels, BYTE* row)
+{
+    for(int i = first; i < pixels; ++i)
+    {
+        for(int channel = 0; channel < channels; ++channel)
+        {
+            row[i * channels + channel] = planes[channel][i];
+        }
+    }
+}
+
+void extractChannelScalar(const BYTE* row, int channels, int channel, int first, int pixels, BYTE* plane)
+{
+    for(int i = first; i < pixels; ++i)
+    {
+        plane[i] = row[i * channels + channel];
+    }
+}
+
+void insertChannelScalar(const BYTE* plane, int channels, int channel, int first, int pixels, BYTE* row)
+{
+    for(int i = first; i < pixels; ++i)
+    {
+        row[i * channels + channel] = plane[i];
+    }
+}
+
+#ifdef IMAGECOMPRESSOR_PLANAR_SSSE3
+// pshufb masks for 16 pixels at a time, 0x80 clears the byte
+struct ShuffleMasks
+{
+    BYTE interleave3[3][3][16]; // [output vector][plane][byte]
+    BYTE transpose4[16]; // 4 pixels of 4 bytes to 4 bytes of every channel and back
+    // one channel of 16 pixels of 2 to 4 channels: [channels - 2][channel][interleaved vector][byte]
+    BYTE extract[3][MAX_CHANNELS][MAX_CHANNELS][16];
+    BYTE insert[3][MAX_CHANNELS][MAX_CHANNELS][16];
+    BYTE keep[3][MAX_CHANNELS][MAX_CHANNELS][16]; // 0xff for bytes of the other channels
+
+    ShuffleMasks()
+    {
+        for(int first = 0; first < 3; ++first)
+        {
+            for(int second = 0; second < 3; ++second)
+            {
+                for(int i = 0; i < 16; ++i)
+                {
+                    // byte i of output vector first is channel (16 * first + i) % 3 of pixel (16 * first + i) / 3
+                    int target = 16 * first + i;
+                    interleave3[first][second][i] = target % 3 == second ? static_cast<BYTE>(target / 3) : 0x80;
+                }
+            }
+        }
+
+        for(int i = 0; i < 16; ++i)
+        {
+            transpose4[i] = static_cast<BYTE>((i % 4) * 4 + i / 4);
+        }
+
+        for(int channels = 2; channels <= MAX_CHANNELS; ++channels)
+        {
+            for(int channel = 0; channel < channels; ++channel)
+            {
+                for(int vector = 0; vector < channels; ++vector)
+                {
+                    for(int i = 0; i < 16; ++i)
+                    {
+                        // channel of pixel i is byte i * channels + channel of the interleaved vectors
+                        int source = i * channels + channel - 16 * vector;
+                        extract[channels - 2][channel][vector][i] = source >= 0 && source < 16 ? static_cast<BYTE>(source) : 0x80;
+
+                        int target = 16 * vector + i;
+                        bool ours = target % channels == channel;
+                        insert[channels - 2][channel][vector][i] = ours ? static_cast<BYTE>(target / channels) : 0x80;
+                        keep[channels - 2][channel][vector][i] = ours ? 0x00 : 0xff;
+                    }
+                }
+            }
+        }
+    }
+};
+
+const ShuffleMasks& shuffleMasks()
+{
+    static const ShuffleMasks masks;
+    return masks;
+}
+
+IMAGECOMPRESSOR_TARGET_SSSE3
+__m128i load(const BYTE* data)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+
+IMAGECOMPRESSOR_TARGET_SSSE3
+void store(BYTE* data, __m128i value)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(data), value);
+}
+
+// 4x4 transpose of 32-bit lanes
+IMAGECOMPRESSOR_TARGET_SSSE3
+void transpose4(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+    __m128i ab0 = _mm_unpacklo_epi32(a, b);
+    __m128i ab1 = _mm_unpackhi_epi32(a, b);
+    __m128i cd0 = _mm_unpacklo_epi32(c, d);
+    __m128i cd1 = _mm_unpackhi_epi32(c, d);
+
+    a = _mm_unpacklo_epi64(ab0, cd0);
+    b = _mm_unpackhi_epi64(ab0, cd0);
+    c = _mm_unpacklo_epi64(ab1, cd1);
+    d = _mm_unpackhi_epi64(ab1, cd1);
+}
+
+// returns the number of pixels done, the rest is left to the scalar loop
+IMAGECOMPRESSOR_TARGET_SSSE3
+int interleaveRowSsse3(const BYTE* const* planes, int channels, int pixels, BYTE* row, const ShuffleMasks& masks)
+{
+    int i = 0;
+
+    if(channels == 3)
+    {
+        for(; i + 16 <= pixels; i += 16)
+        {
+            __m128i input[3] = {load(planes[0] + i), load(planes[1] + i), load(planes[2] + i)};
+            BYTE* target = row + i * 3;
+
+            for(int output = 0; output < 3; ++output)
+            {
+                __m128i value = _mm_shuffle_epi8(input[0], load(masks.interleave3[output][0]));
+                value = _mm_or_si128(value, _mm_shuffle_epi8(input[1], load(masks.interleave3[output][1])));
+                value = _mm_or_si128(value, _mm_shuffle_epi8(input[2], load(masks.interleave3[output][2])));
+                store(target + output * 16, value);
+            }
+        }
+    }
+    else if(channels == 4)
+    {
+        __m128i mask = load(masks.transpose4);
+
+        for(; i + 16 <= pixels; i += 16)
+        {
+            __m128i a = load(planes[0] + i);
+            __m128i b = load(planes[1] + i);
+            __m128i c = load(planes[2] + i);
+            __m128i d = load(planes[3] + i);
+            transpose4(a, b, c, d);
+
+            BYTE* target = row + i * 4;
+            store(target, _mm_shuffle_epi8(a, mask));
+            store(target + 16, _mm_shuffle_epi8(b, mask));
+            store(target + 32, _mm_shuffle_epi8(c, mask));
+            store(target + 48, _mm_shuffle_epi8(d, mask));
+        }
+    }
+
+    return i;
+}
+
+IMAGECOMPRESSOR_TARGET_SSSE3
+int extractChannelSsse3(const BYTE* row, int channels, int channel, int pixels, BYTE* plane, const ShuffleMasks& masks)
+{
+    const BYTE (*vectorMasks)[16] = masks.extract[channels - 2][channel];
+    int i = 0;
+
+    for(; i + 16 <= pixels; i += 16)
+    {
+        const BYTE* source = row + i * channels;
+        __m128i value = _mm_shuffle_epi8(load(source), load(vectorMasks[0]));
+
+        for(int vector = 1; vector < channels; ++vector)
+        {
+            value = _mm_or_si128(value, _mm_shuffle_epi8(load(source + 16 * vector), load(vectorMasks[vector])));
+        }
+
+        store(plane + i, value);
+    }
+
+    return i;
+}
+
+IMAGECOMPRESSOR_TARGET_SSSE3
+int insertChannelSsse3(const BYTE* plane, int channels, int channel, int pixels, BYTE* row, const ShuffleMasks& masks)
+{
+    const BYTE (*insertMasks)[16] = masks.insert[channels - 2][channel];
+    const BYTE (*keepMasks)[16] = masks.keep[channels - 2][channel];
+    int i = 0;
+
+    for(; i + 16 <= pixels; i += 16)
+    {
+        __m128i value = load(plane + i);
+        BYTE* target = row + i * channels;
+
+        for(int vector = 0; vector < channels; ++vector)
+        {
+            __m128i kept = _mm_and_si128(load(target + 16 * vector), load(keepMasks[vector]));
+            store(target + 16 * vector, _mm_or_si128(kept, _mm_shuffle_epi8(value, load(insertMasks[vector]))));
+        }
+    }
+
+    return i;
+}
+
+bool hasSsse3()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+#endif
+
+bool useSsse3()
+{
+#ifdef IMAGECOMPRESSOR_PLANAR_SSSE3
+    static const bool supported = hasSsse3();
+    return supported;
+#else
+    return false;
+#endif
+}
+}
+
+void ImageCompressor::Detail::interleaveRows(const BYTE* planes, int channels, int pixelsPerRow, int height, BYTE* data, int stride)
+{
+    size_t planeSize = static_cast<size_t>(pixelsPerRow) * height;
+    int rowBytes = pixelsPerRow * channels;
+
+    for(int raw = 0; raw < height; ++raw)
+    {
+        BYTE* row = data + static_cast<size_t>(raw) * stride;
+        const BYTE* planeRows[MAX_CHANNELS];
+
+        for(int channel = 0; channel < channels && channel < MAX_CHANNELS; ++channel)
+        {
+            planeRows[channel] = planes + channel * planeSize + static_cast<size_t>(raw) * pixelsPerRow;
+        }
+
+        int done = 0;
+
+#ifdef IMAGECOMPRESSOR_PLANAR_SSSE3
+        if(useSsse3())
+        {
+            done = interleaveRowSsse3(planeRows, channels, pixelsPerRow, row, shuffleMasks());
+        }
+#endif
+
+        interleaveRowScalar(planeRows, channels, done, pixelsPerRow, row);
+
+        if(stride > rowBytes)
+        {
+            memset(row + rowBytes, 0, stride - rowBytes);
+        }
+    }
+}
+
+void ImageCompressor::Detail::extractChannel(const BYTE* row, int channels, int channel, int pixels, BYTE* plane)
+{
+    int done = 0;
+
+#ifdef IMAGECOMPRESSOR_PLANAR_SSSE3
+    if(useSsse3() && channels >= 2 && channels <= MAX_CHANNELS)
+    {
+        done = extractChannelSsse3(row, channels, channel, pixels, plane, shuffleMasks());
+    }
+#endif
+
+    extractChannelScalar(row, channels, channel, done, pixels, plane);
+}
+
+void ImageCompressor::Detail::insertChannel(const BYTE* plane, int channels, int channel, int pixels, BYTE* row)
+{
+    int done = 0;
+
+#ifdef IMAGECOMPRESSOR_PLANAR_SSSE3
+    if(useSsse3() && channels >= 2 && channels <= MAX_CHANNELS)
+    {
+        done = insertChannelSsse3(plane, channels, channel, pixels, row, shuffleMasks());
+    }
+#endif
+
+    insertChannelScalar(plane, channels, channel, done, pixels, row);
+}
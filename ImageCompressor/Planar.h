@@ -0,0 +1,24 @@
+#ifndef PLANAR_H
+#define PLANAR_H
+
+#include "ImageCompressor.h"
+
+// Internal conversion between interleaved pixels (BGR, BGRA, ...) and one plane per channel.
+namespace ImageCompressor
+{
+namespace Detail
+{
+    // Joins channels planes of pixelsPerRow x height bytes, stored one after another in planes, into height
+    // rows of stride bytes. Bytes of a row after pixelsPerRow * channels are set to zero.
+    void interleaveRows(const BYTE* planes, int channels, int pixelsPerRow, int height, BYTE* data, int stride);
+
+    // Copies channel of pixels interleaved pixels of row into plane.
+    void extractChannel(const BYTE* row, int channels, int channel, int pixels, BYTE* plane);
+
+    // Reverses extractChannel. Other channels of row are written back as they were, so no other
+    // thread may write the same pixels at the same time.
+    void insertChannel(const BYTE* plane, int channels, int channel, int pixels, BYTE* row);
+}
+};
+
+#endif // PLANAR_H
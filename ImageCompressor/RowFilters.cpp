@@ -0,0 +1,268 @@
+#include "RowFilters.h"
+
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGECOMPRESSOR_ROWFILTERS_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace::ImageCompressor;
+using Detail::RowFilter;
+
+namespace
+{
+BYTE paethPredictor(int left, int up, int upLeft)
+{
+    int pa = up > upLeft ? up - upLeft : upLeft - up;
+    int pb = left > upLeft ? left - upLeft : upLeft - left;
+    int pc = left + up - 2 * upLeft;
+    pc = pc < 0 ? -pc : pc;
+
+    if(pa <= pb && pa <= pc)
+    {
+        return static_cast<BYTE>(left);
+    }
+
+    return static_cast<BYTE>(pb <= pc ? up : upLeft);
+}
+
+// predictions for column i, left and upper left are zero in the first column
+BYTE predict(RowFilter filter, const BYTE* row, const BYTE* prev, int i)
+{
+    int left = i > 0 ? row[i - 1] : 0;
+    int upLeft = i > 0 ? prev[i - 1] : 0;
+
+    switch(filter)
+    {
+    case RowFilter::SUB:
+        return static_cast<BYTE>(left);
+    case RowFilter::UP:
+        return prev[i];
+    case RowFilter::AVERAGE:
+        return static_cast<BYTE>((left + prev[i]) >> 1);
+    case RowFilter::PAETH:
+        return paethPredictor(left, prev[i], upLeft);
+    default:
+        return 0;
+    }
+}
+
+#ifdef IMAGECOMPRESSOR_ROWFILTERS_SSE2
+__m128i load(const BYTE* data)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+
+__m128i abs16(__m128i value)
+{
+    return _mm_max_epi16(value, _mm_sub_epi16(_mm_setzero_si128(), value));
+}
+
+__m128i select(__m128i mask, __m128i ifSet, __m128i ifClear)
+{
+    return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear));
+}
+
+__m128i paethPredictor16(__m128i left, __m128i up, __m128i upLeft)
+{
+    __m128i upDiff = _mm_sub_epi16(up, upLeft);
+    __m128i leftDiff = _mm_sub_epi16(left, upLeft);
+    __m128i pa = abs16(upDiff);
+    __m128i pb = abs16(leftDiff);
+    __m128i pc = abs16(_mm_add_epi16(upDiff, leftDiff));
+
+    __m128i notLeft = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    __m128i upOrUpLeft = select(_mm_cmpgt_epi16(pb, pc), upLeft, up);
+
+    return select(notLeft, upOrUpLeft, left);
+}
+
+// 16 predictions for columns [i, i + 16), i > 0
+__m128i predict16(RowFilter filter, const BYTE* row, const BYTE* prev, int i)
+{
+    switch(filter)
+    {
+    case RowFilter::SUB:
+        return load(row + i - 1);
+    case RowFilter::UP:
+        return load(prev + i);
+    case RowFilter::AVERAGE:
+    {
+        __m128i left = load(row + i - 1);
+        __m128i up = load(prev + i);
+        // _mm_avg_epu8 rounds up, the filter rounds down
+        __m128i roundedUp = _mm_and_si128(_mm_xor_si128(left, up), _mm_set1_epi8(1));
+        return _mm_sub_epi8(_mm_avg_epu8(left, up), roundedUp);
+    }
+    case RowFilter::PAETH:
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i left = load(row + i - 1);
+        __m128i up = load(prev + i);
+        __m128i upLeft = load(prev + i - 1);
+
+        __m128i low = paethPredictor16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(up, zero), _mm_unpacklo_epi8(upLeft, zero));
+        __m128i high = paethPredictor16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(up, zero), _mm_unpackhi_epi8(upLeft, zero));
+        return _mm_packus_epi16(low, high);
+    }
+    default:
+        return _mm_setzero_si128();
+    }
+}
+#endif
+
+uint64_t sumOfAbsoluteResiduals(const BYTE* data, int width)
+{
+    uint64_t sum = 0;
+    int i = 0;
+
+#ifdef IMAGECOMPRESSOR_ROWFILTERS_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i sums = zero;
+
+    for(; i + 16 <= width; i += 16)
+    {
+        __m128i value = load(data + i);
+        __m128i negative = _mm_cmpgt_epi8(zero, value);
+        __m128i absolute = _mm_sub_epi8(_mm_xor_si128(value, negative), negative);
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(absolute, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for(; i < width; ++i)
+    {
+        int value = static_cast<signed char>(data[i]);
+        sum += value < 0 ? -value : value;
+    }
+
+    return sum;
+}
+
+bool isWhiteRow(const BYTE* row, int width)
+{
+    for(int i = 0; i < width; ++i)
+    {
+        if(row[i] != 0xff)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+}
+
+void ImageCompressor::Detail::filterRow(RowFilter filter, const BYTE* row, const BYTE* prev, BYTE* out, int width)
+{
+    if(filter == RowFilter::NONE || width <= 0)
+    {
+        memcpy(out, row, width > 0 ? width : 0);
+        return;
+    }
+
+    out[0] = static_cast<BYTE>(row[0] - predict(filter, row, prev, 0));
+    int i = 1;
+
+#ifdef IMAGECOMPRESSOR_ROWFILTERS_SSE2
+    for(; i + 16 <= width; i += 16)
+    {
+        __m128i residual = _mm_sub_epi8(load(row + i), predict16(filter, row, prev, i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), residual);
+    }
+#endif
+
+    for(; i < width; ++i)
+    {
+        out[i] = static_cast<BYTE>(row[i] - predict(filter, row, prev, i));
+    }
+}
+
+void ImageCompressor::Detail::unfilterRow(RowFilter filter, BYTE* row, const BYTE* prev, int width)
+{
+    int i = 0;
+
+    switch(filter)
+    {
+    case RowFilter::NONE:
+        return;
+    case RowFilter::SUB:
+    {
+#ifdef IMAGECOMPRESSOR_ROWFILTERS_SSE2
+        // prefix sum of 16 bytes in four shifted additions plus the last byte of the previous block
+        __m128i carry = _mm_setzero_si128();
+
+        for(; i + 16 <= width; i += 16)
+        {
+            __m128i value = load(row + i);
+            value = _mm_add_epi8(value, _mm_slli_si128(value, 1));
+            value = _mm_add_epi8(value, _mm_slli_si128(value, 2));
+            value = _mm_add_epi8(value, _mm_slli_si128(value, 4));
+            value = _mm_add_epi8(value, _mm_slli_si128(value, 8));
+            value = _mm_add_epi8(value, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), value);
+            carry = _mm_set1_epi8(static_cast<char>(row[i + 15]));
+        }
+#endif
+        break;
+    }
+    case RowFilter::UP:
+    {
+#ifdef IMAGECOMPRESSOR_ROWFILTERS_SSE2
+        for(; i + 16 <= width; i += 16)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), _mm_add_epi8(load(row + i), load(prev + i)));
+        }
+#endif
+        break;
+    }
+    default:
+        break;
+    }
+
+    // AVERAGE and PAETH depend on the byte just restored on the left, so they stay scalar
+    for(; i < width; ++i)
+    {
+        row[i] = static_cast<BYTE>(row[i] + predict(filter, row, prev, i));
+    }
+}
+
+RowFilter ImageCompressor::Detail::filterRowAdaptive(const BYTE* row, const BYTE* prev, BYTE* out, BYTE* scratch, int width, bool usePrev)
+{
+    if(isWhiteRow(row, width))
+    {
+        filterRow(RowFilter::NONE, row, prev, out, width);
+        return RowFilter::NONE;
+    }
+
+    BYTE* best = out;
+    BYTE* candidate = scratch;
+    RowFilter bestFilter = RowFilter::NONE;
+    uint64_t bestCost = 0;
+    int filtersCount = usePrev ? ROW_FILTERS_COUNT : static_cast<int>(RowFilter::SUB) + 1;
+
+    for(int filter = 0; filter < filtersCount; ++filter)
+    {
+        filterRow(static_cast<RowFilter>(filter), row, prev, candidate, width);
+        uint64_t cost = sumOfAbsoluteResiduals(candidate, width);
+
+        if(filter == 0 || cost < bestCost)
+        {
+            bestCost = cost;
+            bestFilter = static_cast<RowFilter>(filter);
+            std::swap(best, candidate);
+        }
+    }
+
+    if(best != out)
+    {
+        memcpy(out, best, width);
+    }
+
+    return bestFilter;
+}
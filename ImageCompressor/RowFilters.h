@@ -0,0 +1,35 @@
+#ifndef ROWFILTERS_H
+#define ROWFILTERS_H
+
+#include "ImageCompressor.h"
+
+// Internal PNG-style row filters. Bytes are predicted from the byte on the left and the bytes
+// of the previous row; the first row and the first byte use zeros for missing neighbours.
+namespace ImageCompressor
+{
+namespace Detail
+{
+    enum class RowFilter : BYTE
+    {
+        NONE = 0,
+        SUB, // left
+        UP, // above
+        AVERAGE, // (left + above) / 2
+        PAETH // whichever of left, above, upper left is closest to left + above - upper left
+    };
+
+    const int ROW_FILTERS_COUNT = 5;
+
+    // prev is the previous row of the source image, a row of zeros for the first row
+    void filterRow(RowFilter filter, const BYTE* row, const BYTE* prev, BYTE* out, int width);
+    // reverses filterRow in place, prev is the previous already unfiltered row
+    void unfilterRow(RowFilter filter, BYTE* row, const BYTE* prev, int width);
+
+    // Picks the filter with the smallest sum of absolute residuals and writes the filtered row to out.
+    // Rows which are entirely white are kept as they are, they cost nothing in the token stage.
+    // Without usePrev only filters which don't look at the previous row are tried.
+    RowFilter filterRowAdaptive(const BYTE* row, const BYTE* prev, BYTE* out, BYTE* scratch, int width, bool usePrev);
+}
+};
+
+#endif // ROWFILTERS_H
@@ -0,0 +1,72 @@
+#ifndef TOKENSTREAM_H
+#define TOKENSTREAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ImageCompressor.h"
+
+// Internal access to the compressed token stream for code which works on file bytes directly.
+namespace ImageCompressor
+{
+namespace Detail
+{
+    // Rows as they are in the token stream: planes one after another, tiles of a plane left to right
+    // and top to bottom, rows of a tile one after another. An image which is neither planar nor tiled
+    // is a single plane made of a single tile.
+    struct StoredLayout
+    {
+        int width = 0; // bytes per row of a plane
+        int height = 0; // rows of a plane
+        int planes = 1;
+        int tileWidth = 0; // the whole plane if the image isn't tiled
+        int tileHeight = 0;
+        int tilesX = 1;
+        int tilesY = 1;
+        int rows = 0; // stored rows of all tiles of all planes
+        int segments = 1; // tiles of all planes
+    };
+
+    // Tile of a plane and the place of its rows in the stored rows. The first row of a segment
+    // never depends on the previous one, so every segment can be coded on its own.
+    struct StoredSegment
+    {
+        int plane = 0;
+        int x = 0; // position in the plane
+        int y = 0;
+        int width = 0;
+        int height = 0;
+        int firstRow = 0;
+    };
+
+    // Returns false if the planar or tile parameters don't fit the image.
+    bool storedLayout(int width, int height, int planarChannels, int pixelsPerRow, int tileWidth, int tileHeight, StoredLayout& layout);
+    StoredSegment storedSegment(const StoredLayout& layout, int index);
+    int storedSegmentOfRow(const StoredLayout& layout, int row);
+
+    // Compressed image as it lies in a file buffer, nothing is copied.
+    struct TokenStreamView
+    {
+        const BYTE* data = nullptr; // compressed bit stream
+        size_t size = 0; // bit stream size in bytes
+        StoredLayout layout;
+        const BYTE* rowFlags = nullptr; // empty row flags, one byte or one bit per row
+        bool packedRowFlags = false; // one bit per row, most significant bit first
+        const BYTE* bands = nullptr; // band records: uint64 bit offset + uint32 checksum, may be null
+        int rowsPerBand = 0;
+        PayloadCoding payloadCoding = PayloadCoding::RAW;
+        const BYTE* codeLengths = nullptr; // 256 Huffman code lengths when payloadCoding is HUFFMAN
+        const BYTE* segmentOffsets = nullptr; // uint64 bit offset of every segment, may be null
+        const BYTE* rowFilters = nullptr; // filter of every row, may be null
+        const BYTE* rowOffsets = nullptr; // uint64 bit offset of every row and of the end, may be null
+    };
+
+    // Walks the tokens of every row without writing pixels. Returns false if the tokens don't cover
+    // exactly the bytes of each not empty row, if a band, a segment or a row starts at the wrong bit, if the first
+    // row of a segment uses the previous row or if the stream has bytes left after the last token.
+    // Linear in the stream size and allocates nothing.
+    bool checkTokenStream(const TokenStreamView& view);
+}
+};
+
+#endif // TOKENSTREAM_H
@@ -0,0 +1,240 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace::ImageCompressor;
+
+namespace
+{
+struct Event
+{
+    const char* name;
+    int64_t index;
+    int64_t start; // nanoseconds since Trace::start
+    int64_t duration;
+};
+
+const size_t CHUNK_EVENTS = 1024;
+const size_t MAX_CHUNKS = 4096; // spans of a thread past 4M are dropped
+
+// Written only by its thread. Events are published by count, so write() reads them while the thread goes on
+struct ThreadBuffer
+{
+    int id = 0;
+    std::atomic<Event*> chunks[MAX_CHUNKS];
+    std::atomic<size_t> count{0};
+
+    ThreadBuffer()
+    {
+        for(std::atomic<Event*>& chunk : chunks)
+        {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~ThreadBuffer()
+    {
+        for(std::atomic<Event*>& chunk : chunks)
+        {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    // buffers outlive their threads, worker threads are short-lived and their spans are written at exit. A buffer of
+    // an exited thread is taken over by the next new thread, so there are only as many as threads ran at once.
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<ThreadBuffer*> freeBuffers;
+    std::string path;
+    bool exitHandlerSet = false;
+    std::atomic<bool> enabled{false};
+    std::chrono::steady_clock::time_point origin;
+};
+
+// never destroyed, spans of threads still running at exit may use it after static destructors
+Registry& registry()
+{
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+// returns the buffer of its thread to the free buffers when the thread exits
+struct BufferOwner
+{
+    ThreadBuffer* buffer = nullptr;
+
+    ~BufferOwner()
+    {
+        if(buffer)
+        {
+            Registry& traces = registry();
+            std::lock_guard<std::mutex> lock(traces.mutex);
+            traces.freeBuffers.push_back(buffer);
+        }
+    }
+};
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().origin).count();
+}
+
+ThreadBuffer& bufferOfThread()
+{
+    thread_local BufferOwner owner;
+
+    if(!owner.buffer)
+    {
+        Registry& traces = registry();
+        std::lock_guard<std::mutex> lock(traces.mutex);
+
+        // events of the buffer's former thread stay, the spans of both are shown under its id
+        if(!traces.freeBuffers.empty())
+        {
+            owner.buffer = traces.freeBuffers.back();
+            traces.freeBuffers.pop_back();
+        }
+        else
+        {
+            traces.buffers.emplace_back(new ThreadBuffer());
+            traces.buffers.back()->id = static_cast<int>(traces.buffers.size());
+            owner.buffer = traces.buffers.back().get();
+        }
+    }
+
+    return *owner.buffer;
+}
+
+void record(const Event& event)
+{
+    ThreadBuffer& buffer = bufferOfThread();
+    size_t count = buffer.count.load(std::memory_order_relaxed);
+    size_t chunk = count / CHUNK_EVENTS;
+
+    if(chunk >= MAX_CHUNKS)
+    {
+        return;
+    }
+
+    Event* events = buffer.chunks[chunk].load(std::memory_order_relaxed);
+
+    if(!events)
+    {
+        events = new Event[CHUNK_EVENTS];
+        buffer.chunks[chunk].store(events, std::memory_order_release);
+    }
+
+    events[count % CHUNK_EVENTS] = event;
+    buffer.count.store(count + 1, std::memory_order_release);
+}
+
+// microseconds with 3 decimals, printed as integers so the C locale of the process doesn't matter
+void writeMicroseconds(std::FILE* file, int64_t nanoseconds)
+{
+    std::fprintf(file, "%lld.%03lld", static_cast<long long>(nanoseconds / 1000), static_cast<long long>(nanoseconds % 1000));
+}
+
+void writeOnExit()
+{
+    std::string path;
+
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        path = registry().path;
+    }
+
+    Trace::write(path);
+}
+}
+
+void ImageCompressor::Trace::start(const std::string& path)
+{
+    Registry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    traces.path = path;
+
+    if(!traces.exitHandlerSet)
+    {
+        traces.origin = std::chrono::steady_clock::now();
+        traces.exitHandlerSet = std::atexit(writeOnExit) == 0;
+    }
+
+    traces.enabled.store(true, std::memory_order_release);
+}
+
+bool ImageCompressor::Trace::enabled()
+{
+    return registry().enabled.load(std::memory_order_acquire);
+}
+
+bool ImageCompressor::Trace::write(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "w");
+
+    if(!file)
+    {
+        return false;
+    }
+
+    Registry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    bool first = true;
+
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for(const std::unique_ptr<ThreadBuffer>& buffer : traces.buffers)
+    {
+        size_t count = buffer->count.load(std::memory_order_acquire);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            const Event& event = buffer->chunks[i / CHUNK_EVENTS].load(std::memory_order_acquire)[i % CHUNK_EVENTS];
+
+            std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":", first ? "" : ",", event.name, buffer->id);
+            writeMicroseconds(file, event.start);
+            std::fprintf(file, ",\"dur\":");
+            writeMicroseconds(file, event.duration);
+
+            if(event.index >= 0)
+            {
+                std::fprintf(file, ",\"args\":{\"index\":%lld}", static_cast<long long>(event.index));
+            }
+
+            std::fprintf(file, "}");
+            first = false;
+        }
+    }
+
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
+
+ImageCompressor::Trace::Span::Span(const char* name, int64_t index) : name{name}, index{index}, start{-1}
+{
+    if(enabled())
+    {
+        start = now();
+    }
+}
+
+ImageCompressor::Trace::Span::~Span()
+{
+    if(start >= 0)
+    {
+        Event event;
+        event.name = name;
+        event.index = index;
+        event.start = start;
+        event.duration = now() - start;
+        record(event);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// Scoped spans written as Chrome trace-event JSON, which chrome://tracing and Perfetto open.
+// Spans are only compiled in with IMAGECOMPRESSOR_TRACE, and only recorded after Trace::start.
+namespace ImageCompressor
+{
+namespace Trace
+{
+    // Starts recording, the spans are written to path when the process exits.
+    void start(const std::string& path);
+    bool enabled();
+    // Writes the spans recorded so far, returns false if the file can't be written. Spans still
+    // open on other threads are left out.
+    bool write(const std::string& path);
+
+    // Records the time between its construction and destruction on the calling thread. Every running thread
+    // has a buffer of its own, so recording takes no lock. Buffers of exited threads are reused, so spans of
+    // threads which didn't run at the same time may share a tid. name must be a string literal without quotes
+    // or backslashes, index is shown as an argument of the span unless it is negative.
+    class Span
+    {
+    public:
+        explicit Span(const char* name, int64_t index = -1);
+        ~Span();
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name;
+        int64_t index;
+        int64_t start;
+    };
+}
+};
+
+#ifdef IMAGECOMPRESSOR_TRACE
+#define IMAGECOMPRESSOR_TRACE_JOIN(a, b) a##b
+#define IMAGECOMPRESSOR_TRACE_VARIABLE(line) IMAGECOMPRESSOR_TRACE_JOIN(traceSpan, line)
+#define IMAGECOMPRESSOR_TRACE_SPAN(...) ImageCompressor::Trace::Span IMAGECOMPRESSOR_TRACE_VARIABLE(__LINE__)(__VA_ARGS__)
+#else
+#define IMAGECOMPRESSOR_TRACE_SPAN(...) do {} while(false)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,154 @@
+#include "XxHash.h"
+
+#include <cstring>
+
+namespace
+{
+const uint64_t PRIME1 = 11400714785074694791ULL;
+const uint64_t PRIME2 = 14029467366897019727ULL;
+const uint64_t PRIME3 = 1609587929392839161ULL;
+const uint64_t PRIME4 = 9650029242287828579ULL;
+const uint64_t PRIME5 = 2870177450012600261ULL;
+
+uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// little-endian reads, as the reference implementation does
+uint64_t read64(const unsigned char* data)
+{
+    uint64_t value = 0;
+
+    for(int i = 7; i >= 0; --i)
+    {
+        value = value << 8 | data[i];
+    }
+
+    return value;
+}
+
+uint32_t read32(const unsigned char* data)
+{
+    return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8
+            | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+uint64_t round(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * PRIME2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * PRIME1;
+}
+
+uint64_t mergeRound(uint64_t hash, uint64_t accumulator)
+{
+    hash ^= round(0, accumulator);
+    return hash * PRIME1 + PRIME4;
+}
+
+// four independent lanes over 32-byte stripes
+void consumeStripe(uint64_t (&lanes)[4], const unsigned char* data)
+{
+    for(int lane = 0; lane < 4; ++lane)
+    {
+        lanes[lane] = round(lanes[lane], read64(data + lane * 8));
+    }
+}
+}
+
+uint64_t ImageCompressor::xxhash64(const unsigned char* data, size_t size, uint64_t seed)
+{
+    XxHash64 state(seed);
+    state.update(data, size);
+    return state.digest();
+}
+
+ImageCompressor::XxHash64::XxHash64(uint64_t seed) : seed{seed}, lanes{seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1}, buffered{0}, size{0}
+{
+}
+
+void ImageCompressor::XxHash64::update(const unsigned char* data, size_t count)
+{
+    if(count == 0)
+    {
+        return;
+    }
+
+    size += count;
+
+    if(buffered + count < sizeof(stripe))
+    {
+        memcpy(stripe + buffered, data, count);
+        buffered += count;
+        return;
+    }
+
+    if(buffered > 0)
+    {
+        size_t fill = sizeof(stripe) - buffered;
+        memcpy(stripe + buffered, data, fill);
+        consumeStripe(lanes, stripe);
+        data += fill;
+        count -= fill;
+        buffered = 0;
+    }
+
+    for(; count >= sizeof(stripe); data += sizeof(stripe), count -= sizeof(stripe))
+    {
+        consumeStripe(lanes, data);
+    }
+
+    memcpy(stripe, data, count);
+    buffered = count;
+}
+
+uint64_t ImageCompressor::XxHash64::digest() const
+{
+    const unsigned char* data = stripe;
+    const unsigned char* end = stripe + buffered;
+    uint64_t hash;
+
+    if(size >= sizeof(stripe))
+    {
+        hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+
+        for(int lane = 0; lane < 4; ++lane)
+        {
+            hash = mergeRound(hash, lanes[lane]);
+        }
+    }
+    else
+    {
+        hash = seed + PRIME5;
+    }
+
+    hash += size;
+
+    for(; end - data >= 8; data += 8)
+    {
+        hash ^= round(0, read64(data));
+        hash = rotateLeft(hash, 27) * PRIME1 + PRIME4;
+    }
+
+    if(end - data >= 4)
+    {
+        hash ^= read32(data) * PRIME1;
+        hash = rotateLeft(hash, 23) * PRIME2 + PRIME3;
+        data += 4;
+    }
+
+    for(; data < end; ++data)
+    {
+        hash ^= *data * PRIME5;
+        hash = rotateLeft(hash, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
@@ -0,0 +1,31 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageCompressor
+{
+    // XXH64, a fast non-cryptographic hash for recognising content which was already seen.
+    // Not meant to detect corruption, bands use CRC32C for that.
+    uint64_t xxhash64(const unsigned char* data, size_t size, uint64_t seed = 0);
+
+    // XXH64 of data given in parts, e.g. a file read a chunk at a time. Gives what xxhash64 gives for all parts at once.
+    class XxHash64
+    {
+    public:
+        explicit XxHash64(uint64_t seed = 0);
+
+        void update(const unsigned char* data, size_t size);
+        uint64_t digest() const;
+
+    private:
+        uint64_t seed;
+        uint64_t lanes[4];
+        unsigned char stripe[32]; // bytes short of a whole stripe, kept until the next update
+        size_t buffered;
+        uint64_t size;
+    };
+};
+
+#endif // XXHASH_H
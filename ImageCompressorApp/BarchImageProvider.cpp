@@ -0,0 +1,131 @@
+#include "BarchImageProvider.h"
+
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QUrl>
+
+namespace
+{
+void deleteImageData(void* data)
+{
+    delete[] static_cast<ImageCompressor::BYTE*>(data);
+}
+
+// the largest preview scale which still gives at least the requested size, 1 if a full decode is needed
+int previewScale(const CompressedImageData& compressed, const QSize& requestedSize)
+{
+    const ImageCompressor::CompressedImage& image = compressed.data;
+    QImage::Format format = compressed.recoveryData.format;
+
+    // previews sample pixels of planar images and bytes of the rest, so without planes only 8-bit images fit
+    bool samplesPixels = image.planarChannels != 0 || format == QImage::Format_Indexed8 || format == QImage::Format_Grayscale8;
+
+    if(!samplesPixels || (requestedSize.width() <= 0 && requestedSize.height() <= 0))
+    {
+        return 1;
+    }
+
+    int scale = 1;
+
+    while(scale < 8 && compressed.recoveryData.originalImageWidth / (scale * 2) >= requestedSize.width()
+          && image.height / (scale * 2) >= requestedSize.height())
+    {
+        scale *= 2;
+    }
+
+    return scale;
+}
+}
+
+BarchImageProvider::BarchImageProvider(int cacheBytes)
+    : QQuickImageProvider(QQuickImageProvider::Image, QQmlImageProviderBase::ForceAsynchronousImageLoading), cache{cacheBytes}
+{
+
+}
+
+QImage BarchImageProvider::requestImage(const QString &id, QSize *size, const QSize &requestedSize)
+{
+    QString path = QUrl::fromPercentEncoding(id.toUtf8());
+    QFileInfo file(path);
+
+    // a file written again gets a new key, the stale image just ages out of the cache
+    QString key = QString("%1|%2|%3x%4").arg(path).arg(file.lastModified().toMSecsSinceEpoch())
+            .arg(requestedSize.width()).arg(requestedSize.height());
+
+    {
+        QMutexLocker locker(&cacheMutex);
+        CachedImage* cached = cache.object(key);
+
+        if(cached)
+        {
+            if(size)
+            {
+                *size = cached->originalSize;
+            }
+
+            return cached->image;
+        }
+    }
+
+    QString errorText;
+    CompressedImageData compressed = readCompressedImageFile(path, errorText);
+
+    if(!compressed.isValid)
+    {
+        qWarning("%s", qPrintable(errorText));
+        return QImage();
+    }
+
+    QSize originalSize(compressed.recoveryData.originalImageWidth, compressed.data.height);
+    QImage image = decodeImage(compressed, requestedSize);
+
+    if(size)
+    {
+        *size = originalSize;
+    }
+
+    if(!image.isNull())
+    {
+        QMutexLocker locker(&cacheMutex);
+        cache.insert(key, new CachedImage{image, originalSize}, static_cast<int>(image.sizeInBytes()));
+    }
+
+    return image;
+}
+
+QImage BarchImageProvider::decodeImage(const CompressedImageData& compressed, const QSize& requestedSize)
+{
+    int scale = previewScale(compressed, requestedSize);
+    ImageCompressor::RawImageData raw;
+
+    try
+    {
+        raw = scale > 1 ? ImageCompressor::decompressPreview(compressed.data, scale) : ImageCompressor::decompressImage(compressed.data);
+    }
+    catch(const ImageCompressor::ImageCompressorException& exception)
+    {
+        qWarning("%s", exception.what());
+        return QImage();
+    }
+
+    int width = (compressed.recoveryData.originalImageWidth + scale - 1) / scale;
+    QImage image(raw.data, width, raw.height, raw.width, compressed.recoveryData.format, deleteImageData, raw.data);
+    image.setColorTable(compressed.recoveryData.colorTable);
+
+    // the preview is at least the requested size, the rest is left to a smooth downscale
+    if(requestedSize.width() > 0 && requestedSize.height() > 0 && (image.width() > requestedSize.width() || image.height() > requestedSize.height()))
+    {
+        image = image.scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    else if(requestedSize.width() > 0 && requestedSize.height() <= 0 && image.width() > requestedSize.width())
+    {
+        image = image.scaledToWidth(requestedSize.width(), Qt::SmoothTransformation);
+    }
+    else if(requestedSize.height() > 0 && requestedSize.width() <= 0 && image.height() > requestedSize.height())
+    {
+        image = image.scaledToHeight(requestedSize.height(), Qt::SmoothTransformation);
+    }
+
+    return image;
+}
@@ -0,0 +1,36 @@
+#ifndef BARCHIMAGEPROVIDER_H
+#define BARCHIMAGEPROVIDER_H
+
+#include <QQuickImageProvider>
+#include <QCache>
+#include <QMutex>
+#include <QImage>
+#include <QString>
+
+#include "ImageHandler.h"
+
+// Serves .barch files to QML as image://barch/<encoded path> without writing them to disk.
+// Images are decoded on QML's loader threads, small requested sizes are decoded at 1/2, 1/4
+// or 1/8 scale straight from the stream. Decoded images are kept in an LRU cache bounded by bytes.
+class BarchImageProvider : public QQuickImageProvider
+{
+public:
+    explicit BarchImageProvider(int cacheBytes = 256 * 1024 * 1024);
+
+    QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize) override;
+
+private:
+    struct CachedImage
+    {
+        QImage image;
+        QSize originalSize;
+    };
+
+    QImage decodeImage(const CompressedImageData& compressed, const QSize& requestedSize);
+
+private:
+    QMutex cacheMutex;
+    QCache<QString, CachedImage> cache; // cost of an image is its size in bytes
+};
+
+#endif // BARCHIMAGEPROVIDER_H
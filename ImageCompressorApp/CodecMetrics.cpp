@@ -0,0 +1,112 @@
+#include "CodecMetrics.h"
+
+#include <QFile>
+#include <QJsonDocument>
+
+CodecMetrics::CodecMetrics(const QString& metricsFilePath) : metricsFilePath{metricsFilePath}
+{
+    load();
+}
+
+CodecMetrics::~CodecMetrics()
+{
+    save();
+}
+
+void CodecMetrics::addCompression(const ImageCompressor::CodecStats& stats, const StageTimes& times)
+{
+    add(compression, stats, times);
+    changed = true;
+}
+
+void CodecMetrics::addDecompression(const ImageCompressor::CodecStats& stats, const StageTimes& times)
+{
+    add(decompression, stats, times);
+    changed = true;
+}
+
+void CodecMetrics::add(Totals& totals, const ImageCompressor::CodecStats& stats, const StageTimes& times)
+{
+    totals.jobs += 1;
+    totals.bytesIn += stats.bytesIn;
+    totals.bytesOut += stats.bytesOut;
+    totals.times.loadMs += times.loadMs;
+    totals.times.codecMs += times.codecMs;
+    totals.times.storeMs += times.storeMs;
+    totals.emptyRows += stats.emptyRows;
+    totals.whiteGroups += stats.whiteGroups;
+    totals.blackGroups += stats.blackGroups;
+    totals.differentGroups += stats.differentGroups;
+    totals.allocations += stats.allocations;
+}
+
+QJsonObject CodecMetrics::toJson(const Totals& totals)
+{
+    // counters stay exact as JSON numbers up to 2^53, far more than a directory of images gets to
+    QJsonObject object;
+    object["jobs"] = static_cast<double>(totals.jobs);
+    object["bytesIn"] = static_cast<double>(totals.bytesIn);
+    object["bytesOut"] = static_cast<double>(totals.bytesOut);
+    object["loadMs"] = totals.times.loadMs;
+    object["codecMs"] = totals.times.codecMs;
+    object["storeMs"] = totals.times.storeMs;
+    object["emptyRows"] = static_cast<double>(totals.emptyRows);
+    object["whiteGroups"] = static_cast<double>(totals.whiteGroups);
+    object["blackGroups"] = static_cast<double>(totals.blackGroups);
+    object["differentGroups"] = static_cast<double>(totals.differentGroups);
+    object["allocations"] = static_cast<double>(totals.allocations);
+
+    return object;
+}
+
+CodecMetrics::Totals CodecMetrics::fromJson(const QJsonObject& object)
+{
+    Totals totals;
+    totals.jobs = static_cast<quint64>(object["jobs"].toDouble());
+    totals.bytesIn = static_cast<quint64>(object["bytesIn"].toDouble());
+    totals.bytesOut = static_cast<quint64>(object["bytesOut"].toDouble());
+    totals.times.loadMs = object["loadMs"].toDouble();
+    totals.times.codecMs = object["codecMs"].toDouble();
+    totals.times.storeMs = object["storeMs"].toDouble();
+    totals.emptyRows = static_cast<quint64>(object["emptyRows"].toDouble());
+    totals.whiteGroups = static_cast<quint64>(object["whiteGroups"].toDouble());
+    totals.blackGroups = static_cast<quint64>(object["blackGroups"].toDouble());
+    totals.differentGroups = static_cast<quint64>(object["differentGroups"].toDouble());
+    totals.allocations = static_cast<quint64>(object["allocations"].toDouble());
+
+    return totals;
+}
+
+void CodecMetrics::load()
+{
+    QFile file(metricsFilePath);
+
+    if(!file.open(QFile::ReadOnly))
+    {
+        return;
+    }
+
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    compression = fromJson(root["compression"].toObject());
+    decompression = fromJson(root["decompression"].toObject());
+}
+
+void CodecMetrics::save()
+{
+    if(!changed)
+    {
+        return;
+    }
+
+    QJsonObject root;
+    root["compression"] = toJson(compression);
+    root["decompression"] = toJson(decompression);
+
+    QFile file(metricsFilePath);
+
+    if(file.open(QFile::WriteOnly))
+    {
+        changed = file.write(QJsonDocument(root).toJson(QJsonDocument::Indented)) < 0;
+        file.close();
+    }
+}
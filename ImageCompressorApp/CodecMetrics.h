@@ -0,0 +1,56 @@
+#ifndef CODECMETRICS_H
+#define CODECMETRICS_H
+
+#include <QJsonObject>
+#include <QString>
+#include "ImageCompressor.h"
+
+// Milliseconds of the stages of one file: reading it, the codec itself and writing the result.
+struct StageTimes
+{
+    double loadMs = 0;
+    double codecMs = 0;
+    double storeMs = 0;
+};
+
+// Totals of every compression and decompression made in a directory, kept as JSON next to the images
+// so the cost of a whole batch can be read after the app is closed.
+class CodecMetrics
+{
+public:
+    explicit CodecMetrics(const QString& metricsFilePath);
+    ~CodecMetrics();
+
+    // totals are only kept in memory until save
+    void addCompression(const ImageCompressor::CodecStats& stats, const StageTimes& times);
+    void addDecompression(const ImageCompressor::CodecStats& stats, const StageTimes& times);
+    // writes the totals if they changed since they were last written
+    void save();
+
+private:
+    struct Totals
+    {
+        quint64 jobs = 0;
+        quint64 bytesIn = 0;
+        quint64 bytesOut = 0;
+        StageTimes times;
+        quint64 emptyRows = 0;
+        quint64 whiteGroups = 0;
+        quint64 blackGroups = 0;
+        quint64 differentGroups = 0;
+        quint64 allocations = 0;
+    };
+
+    static void add(Totals& totals, const ImageCompressor::CodecStats& stats, const StageTimes& times);
+    static QJsonObject toJson(const Totals& totals);
+    static Totals fromJson(const QJsonObject& object);
+    void load();
+
+private:
+    QString metricsFilePath;
+    Totals compression;
+    Totals decompression;
+    bool changed = false;
+};
+
+#endif // CODECMETRICS_H
@@ -15,8 +15,8 @@ public:
     };
 
 public:
-    FileInfo(const QString& filePath, uint64_t size) : filePath{filePath}, size{size}, status{FileStatus::NONE} {}
-    void setStatus(FileStatus status) {this->status = status;}
+    FileInfo(const QString& filePath, uint64_t size) : filePath{filePath}, size{size}, status{FileStatus::NONE}, progress{0}, ratio{0}, throughput{0} {}
+    void setStatus(FileStatus status) {this->status = status; progress = 0;}
     FileStatus getStatus(){return status;}
     uint64_t getSize() const {return size;}
     QString getStatusString() const
@@ -37,14 +37,30 @@ public:
         }
         }
 
+        if(status != FileStatus::NONE && progress > 0)
+        {
+            statusStr+=" " + QString::number(progress) + "%";
+        }
+
         return statusStr;
     }
+    // percent of the running compression or decompression
+    void setProgress(int progress) {this->progress = progress;}
+    int getProgress() const {return progress;}
     QString getFilePath() const {return filePath;}
+    // image bytes per compressed byte and image megabytes per second of the last compression or decompression
+    void setRatio(double ratio) {this->ratio = ratio;}
+    double getRatio() const {return ratio;}
+    void setThroughput(double throughput) {this->throughput = throughput;}
+    double getThroughput() const {return throughput;}
 
 private:
     QString filePath;
     FileStatus status;
     uint64_t size;
+    int progress;
+    double ratio;
+    double throughput;
 };
 
 #endif // FILEINFO_H
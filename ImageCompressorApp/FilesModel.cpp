@@ -29,6 +29,12 @@ QVariant FilesModel::data(const QModelIndex &index, int role) const
         return file.getStatusString();
     if( static_cast<FileRoles>(role) == FileRoles::SIZE_ROLE)
         return file.getSize();
+    if( static_cast<FileRoles>(role) == FileRoles::RATIO_ROLE)
+        return file.getRatio();
+    if( static_cast<FileRoles>(role) == FileRoles::THROUGHPUT_ROLE)
+        return file.getThroughput();
+    if( static_cast<FileRoles>(role) == FileRoles::PROGRESS_ROLE)
+        return file.getProgress();
      return QVariant();
 }
 
@@ -52,6 +58,33 @@ bool FilesModel::setData(const QModelIndex &index, const QVariant &value, int ro
         }
         break;
     }
+    case FileRoles::RATIO_ROLE:
+    {
+        if(file.getRatio() != value.toDouble())
+        {
+            file.setRatio(value.toDouble());
+            somethingChanged = true;
+        }
+        break;
+    }
+    case FileRoles::THROUGHPUT_ROLE:
+    {
+        if(file.getThroughput() != value.toDouble())
+        {
+            file.setThroughput(value.toDouble());
+            somethingChanged = true;
+        }
+        break;
+    }
+    case FileRoles::PROGRESS_ROLE:
+    {
+        if(file.getProgress() != value.toInt())
+        {
+            file.setProgress(value.toInt());
+            somethingChanged = true;
+        }
+        break;
+    }
     }
 
     if(somethingChanged)
@@ -69,6 +102,9 @@ QHash<int, QByteArray> FilesModel::roleNames() const
     roles[static_cast<int>(FileRoles::FILENAME_ROLE)] = "filename";
     roles[static_cast<int>(FileRoles::SIZE_ROLE)] = "size";
     roles[static_cast<int>(FileRoles::STATUS_ROLE)] = "status";
+    roles[static_cast<int>(FileRoles::RATIO_ROLE)] = "ratio";
+    roles[static_cast<int>(FileRoles::THROUGHPUT_ROLE)] = "throughput";
+    roles[static_cast<int>(FileRoles::PROGRESS_ROLE)] = "progress";
     return roles;
 }
 
@@ -15,7 +15,10 @@ public:
     enum class FileRoles{
         FILENAME_ROLE = Qt::UserRole + 1,
         SIZE_ROLE,
-        STATUS_ROLE
+        STATUS_ROLE,
+        RATIO_ROLE,
+        THROUGHPUT_ROLE,
+        PROGRESS_ROLE
     };
 
 public:
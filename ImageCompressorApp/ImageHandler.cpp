@@ -1,12 +1,41 @@
 
 #include "ImageHandler.h"
+#include "Trace.h"
 #include <QtConcurrent>
+#include <QFutureInterface>
 #include <QBitmap>
 #include <QImage>
 #include <QFile>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <limits>
 
-ImageHandler::ImageHandler(FilesModel &model, QObject *parent)
-    :model{model}
+namespace
+{
+// reports the codec's progress to task in percent, the codec stops at its next report once task is cancelled
+template<typename T>
+ImageCompressor::ProgressCallback progressOf(QFutureInterface<T>& task)
+{
+    return [&task](uint64_t done, uint64_t total){
+        task.setProgressValue(static_cast<int>(done * 100 / total));
+        return !task.isCanceled();
+    };
+}
+
+// options of every compression of the app, the planar layout is set for each image
+ImageCompressor::CompressionOptions compressionOptions()
+{
+    ImageCompressor::CompressionOptions options;
+    options.bandChecksums = true;
+    options.payloadCoding = ImageCompressor::PayloadCoding::HUFFMAN;
+    options.leftPrediction = true;
+    options.rowHashes = true;
+    return options;
+}
+}
+
+ImageHandler::ImageHandler(FilesModel &model, const QString& cacheFilePath, const QString& metricsFilePath, QObject *parent)
+    :model{model}, resultCache{cacheFilePath}, metrics{metricsFilePath}
 {
 
 }
@@ -17,50 +46,176 @@ void ImageHandler::onClickFile(int index)
     QString path = model.data(modelInd, static_cast<int>(FilesModel::FileRoles::FILENAME_ROLE)).toString();
     QFileInfo file(path);
 
-    if(file.suffix() == "bmp")
-    {
-        OriginalImageData originalData = getImageDataFromImage(path);
+    // a click on a file which is being converted cancels it
+    auto job = jobs.find(path);
 
-        if(originalData.data.data)
-        {
-            QFutureWatcher<ImageCompressor::CompressedImage>* watcher = new QFutureWatcher<ImageCompressor::CompressedImage>();
+    if(job != jobs.end())
+    {
+        job.value()->cancel();
+        return;
+    }
 
-            connect(watcher, &QFutureWatcher<void>::finished, [=](){
-                ImageCompressor::CompressedImage result = watcher->result();
-                CompressedImageData compressedData;
-                compressedData.data = std::move(result);
-                compressedData.recoveryData = std::move(originalData.recoveryData);
-                onCompressionFinished(compressedData, path);
-                delete originalData.data.data;
+    if(file.suffix() == "bmp")
+    {
+        QString newPath = path;
+        QString removeExtension = ".bmp";
+        newPath.remove(newPath.lastIndexOf(removeExtension), removeExtension.size());
+        newPath+="_packed.barch";
+
+        QFutureWatcher<ImageCompressor::CompressedImage>* watcher = new QFutureWatcher<ImageCompressor::CompressedImage>();
+        std::shared_ptr<CompressionState> state = std::make_shared<CompressionState>();
+
+        connect(watcher, &QFutureWatcher<void>::progressValueChanged, [=](int value){
+            changeFileProgress(path, value);
+        });
+
+        connect(watcher, &QFutureWatcher<void>::finished, [=](){
+            // a job which was cancelled, failed or found its result there has none, the codec freed its own buffers when it stopped
+            if(watcher->future().resultCount() == 0)
+            {
+                if(state->wouldNotShrink)
+                {
+                    notCompressed(newPath, state->stats.bytesIn, state->stats.bytesOut);
+                }
+                else if(state->original.data.data && !watcher->isCanceled())
+                {
+                    emit error("Compression failed: " + path);
+                }
+
+                delete[] state->original.data.data;
                 changeFileStatus(path, FileInfo::FileStatus::NONE);
+                finishJob(path);
                 watcher->deleteLater();
-            });
-
-            watcher->setFuture(QtConcurrent::run(ImageCompressor::compressImage, originalData.data));
-
-            model.setData(modelInd, QVariant(static_cast<int>(FileInfo::FileStatus::COMPRESSING)), static_cast<int>(FilesModel::FileRoles::STATUS_ROLE));
-        }
+                return;
+            }
+
+            ImageCompressor::CompressedImage result = watcher->result();
+            CompressedImageData compressedData;
+            compressedData.data = std::move(result);
+            compressedData.recoveryData = std::move(state->original.recoveryData);
+
+            QElapsedTimer storeTimer;
+            storeTimer.start();
+            bool stored = onCompressionFinished(compressedData, newPath, state->stats.bytesIn);
+            state->times.storeMs = storeTimer.nsecsElapsed() / 1e6;
+
+            if(stored && state->hashed)
+            {
+                resultCache.addResult(state->resultKey, newPath);
+            }
+
+            metrics.addCompression(state->stats, state->times);
+            showFileMetrics(path, state->stats.bytesIn, state->stats.bytesOut, state->times.codecMs);
+
+            delete[] state->original.data.data;
+            changeFileStatus(path, FileInfo::FileStatus::NONE);
+            finishJob(path);
+            watcher->deleteLater();
+        });
+
+        // the task reports through an interface of its own, so the watcher gets its progress and can cancel it.
+        // Hashing, loading and the codec all run on its thread
+        QFutureInterface<ImageCompressor::CompressedImage> task;
+        task.setProgressRange(0, 100);
+        task.reportStarted();
+        watcher->setFuture(task.future());
+        jobs[path] = watcher;
+
+        QtConcurrent::run([=]() mutable {
+            try
+            {
+                compressFile(path, newPath, *state, task);
+            }
+            catch(...)
+            {
+                // cancelled or failed, even out of memory, the watcher finishes without a result
+            }
+
+            task.reportFinished();
+        });
+
+        model.setData(modelInd, QVariant(static_cast<int>(FileInfo::FileStatus::COMPRESSING)), static_cast<int>(FilesModel::FileRoles::STATUS_ROLE));
     }
     else if(file.suffix() == "barch")
     {
+        QElapsedTimer stageTimer;
+        stageTimer.start();
         CompressedImageData compressedData = getCompressedImageDataFromFile(path);
+        std::shared_ptr<StageTimes> times = std::make_shared<StageTimes>();
+        times->loadMs = stageTimer.nsecsElapsed() / 1e6;
 
         if(compressedData.isValid)
         {
             QFutureWatcher<ImageCompressor::RawImageData>* watcher = new QFutureWatcher<ImageCompressor::RawImageData>();
+            std::shared_ptr<ImageCompressor::DecompressionReport> report = std::make_shared<ImageCompressor::DecompressionReport>();
+            // the decoded image is kept here too, a result reported after the job was cancelled is dropped and freed by the watcher
+            std::shared_ptr<ImageCompressor::RawImageData> decoded = std::make_shared<ImageCompressor::RawImageData>();
+
+            connect(watcher, &QFutureWatcher<void>::progressValueChanged, [=](int value){
+                changeFileProgress(path, value);
+            });
 
             connect(watcher, &QFutureWatcher<void>::finished, [=](){
+                if(watcher->future().resultCount() == 0)
+                {
+                    if(!watcher->isCanceled())
+                    {
+                        emit error("Decompression failed: " + path);
+                    }
+
+                    delete[] decoded->data;
+                    changeFileStatus(path, FileInfo::FileStatus::NONE);
+                    finishJob(path);
+                    watcher->deleteLater();
+                    return;
+                }
+
                 ImageCompressor::RawImageData result = watcher->result();
                 OriginalImageData originalData;
                 originalData.data = std::move(result);
                 originalData.recoveryData = std::move(compressedData.recoveryData);
+
+                QElapsedTimer storeTimer;
+                storeTimer.start();
                 onDecompressionFinished(originalData, path);
-                delete result.data;
+                times->storeMs = storeTimer.nsecsElapsed() / 1e6;
+
+                metrics.addDecompression(report->stats, *times);
+                showFileMetrics(path, report->stats.bytesOut, report->stats.bytesIn, times->codecMs);
+                reportCorruptedBands(*report, compressedData.data, path);
+                delete[] result.data;
                 changeFileStatus(path, FileInfo::FileStatus::NONE);
+                finishJob(path);
                 watcher->deleteLater();
             });
 
-            watcher->setFuture(QtConcurrent::run(ImageCompressor::decompressImage, compressedData.data));
+            QFutureInterface<ImageCompressor::RawImageData> task;
+            task.setProgressRange(0, 100);
+            task.reportStarted();
+            watcher->setFuture(task.future());
+            jobs[path] = watcher;
+
+            QtConcurrent::run([=]() mutable {
+                QElapsedTimer codecTimer;
+                codecTimer.start();
+
+                try
+                {
+                    *decoded = ImageCompressor::decompressImage(compressedData.data, *report, progressOf(task));
+                    times->codecMs = codecTimer.nsecsElapsed() / 1e6;
+
+                    if(!task.isCanceled())
+                    {
+                        task.reportResult(*decoded);
+                    }
+                }
+                catch(...)
+                {
+                    // cancelled or failed, even out of memory, the watcher finishes without a result
+                }
+
+                task.reportFinished();
+            });
 
             model.setData(modelInd, QVariant(static_cast<int>(FileInfo::FileStatus::DECOMPRESSING)), static_cast<int>(FilesModel::FileRoles::STATUS_ROLE));
         }
@@ -71,48 +226,172 @@ void ImageHandler::onClickFile(int index)
     }
 }
 
-void ImageHandler::onCompressionFinished(CompressedImageData& compressed, const QString& path)
+void ImageHandler::compressFile(const QString& path, const QString& newPath, CompressionState& state, QFutureInterface<ImageCompressor::CompressedImage>& task)
 {
-    QString newPath = path;
-    QString removeExtension = ".bmp";
-    newPath.remove(newPath.lastIndexOf(removeExtension), removeExtension.size());
-    newPath+="_packed.barch";
+    // content compressed before with the same options is taken over, whatever the name of its result
+    quint64 hash = 0;
+    state.hashed = resultCache.contentHash(path, hash);
+    state.resultKey = ResultCache::resultKey(hash, compressionOptions());
+    state.reused = state.hashed && reuseCachedResult(state.resultKey, newPath);
+
+    if(state.reused || task.isCanceled())
+    {
+        return;
+    }
+
+    QElapsedTimer stageTimer;
+    stageTimer.start();
+    state.original = getImageDataFromImage(path);
+    state.times.loadMs = stageTimer.nsecsElapsed() / 1e6;
+
+    if(!state.original.data.data)
+    {
+        return;
+    }
+
+    // planar layout follows from the content, so it doesn't need to be part of the result key
+    ImageCompressor::CompressionOptions options = compressionOptions();
+    options.planarChannels = state.original.planarChannels;
+    options.pixelsPerRow = state.original.recoveryData.originalImageWidth;
+
+    // an earlier result of an edited image of the same size and options only needs its changed rows encoded again
+    QString previousError;
+    CompressedImageData previous = QFileInfo::exists(newPath) ? readCompressedImageFile(newPath, previousError) : CompressedImageData();
+    bool incremental = previous.isValid && !previous.data.rowHashes.empty() && previous.recoveryData.format == state.original.recoveryData.format
+            && previous.recoveryData.originalImageWidth == state.original.recoveryData.originalImageWidth
+            && previous.data.width == state.original.data.width && previous.data.height == state.original.data.height
+            && ImageCompressor::compressedWith(previous.data, options);
+
+    stageTimer.restart();
+    ImageCompressor::CompressedImage compressed;
+
+    if(incremental)
+    {
+        // recompressImage keeps no counters, so only the sizes are known
+        compressed = ImageCompressor::recompressImage(state.original.data, options, previous.data, progressOf(task));
+        state.stats.bytesIn = static_cast<quint64>(state.original.data.width) * state.original.data.height;
+        state.stats.bytesOut = compressed.data.size();
+    }
+    else
+    {
+        // the file's size is counted first, chunks and row index included, an image whose file wouldn't be smaller
+        // isn't compressed at all. Only the size of the color table counts for it
+        ImageCompressor::ImageMetadata metadata;
+        metadata.colorTable.resize(state.original.recoveryData.colorTable.size());
+        quint64 imageBytes = static_cast<quint64>(state.original.data.width) * state.original.data.height;
+        quint64 fileBytes = ImageCompressor::estimateSerializedSize(state.original.data, options, metadata);
+
+        if(fileBytes >= imageBytes)
+        {
+            state.wouldNotShrink = true;
+            state.stats.bytesIn = imageBytes;
+            state.stats.bytesOut = fileBytes;
+            return;
+        }
+
+        // the estimate can't be stopped, a click during it cancels before the compression starts
+        if(task.isCanceled())
+        {
+            return;
+        }
+
+        compressed = ImageCompressor::compressImage(state.original.data, options, state.stats, progressOf(task));
+    }
+
+    state.times.codecMs = stageTimer.nsecsElapsed() / 1e6;
+
+    // a result of a cancelled job would be dropped, the watcher frees the image either way
+    if(!task.isCanceled())
+    {
+        task.reportResult(compressed);
+    }
+}
+
+void ImageHandler::finishJob(const QString& path)
+{
+    jobs.remove(path);
+
+    // the cache and the metrics are written once a batch of conversions is done, not after every file
+    if(jobs.isEmpty())
+    {
+        resultCache.save();
+        metrics.save();
+    }
+}
+
+bool ImageHandler::onCompressionFinished(CompressedImageData& compressed, const QString& newPath, quint64 imageBytes)
+{
+    IMAGECOMPRESSOR_TRACE_SPAN("store barch");
+    ImageCompressor::BarchImage image;
+    image.metadata.format = compressed.recoveryData.format;
+    image.metadata.originalImageWidth = compressed.recoveryData.originalImageWidth;
+    image.metadata.colorTable.assign(compressed.recoveryData.colorTable.begin(), compressed.recoveryData.colorTable.end());
+    image.image = std::move(compressed.data);
+
+    std::vector<ImageCompressor::BYTE> fileData = ImageCompressor::serializeImage(image);
+
+    // incremental results aren't estimated, a file which wouldn't be smaller than the image isn't written either
+    if(fileData.size() >= imageBytes)
+    {
+        notCompressed(newPath, imageBytes, fileData.size());
+        return false;
+    }
 
     QFile newFile(newPath);
     newFile.open(QFile::WriteOnly);
 
     if(newFile.isOpen())
     {
-        newFile.write((char*)&compressed.recoveryData.format, sizeof(QImage::Format));
-        newFile.write((char*)&compressed.recoveryData.originalImageWidth, sizeof(qint32));
-        int size = compressed.recoveryData.colorTable.size();
-        newFile.write((char*)&size, sizeof(qint32));
-        newFile.write((char*)compressed.recoveryData.colorTable.data(), sizeof(QRgb) * compressed.recoveryData.colorTable.size());
-
-        newFile.write((char*)&compressed.data.width, sizeof(qint32));
-        newFile.write((char*)&compressed.data.height, sizeof(qint32));
-        size = compressed.data.compressedIndexes.size();
-        newFile.write((char*)&size, sizeof(qint32));
+        bool written = newFile.write((const char*)fileData.data(), fileData.size()) == static_cast<qint64>(fileData.size());
+        newFile.close();
 
-        for(bool el : compressed.data.compressedIndexes)
+        if(!written)
         {
-            newFile.write((char*)&el, sizeof(bool));
+            emit error("Error on save to: " + newPath);
         }
 
-        size = compressed.data.data.size();
-        newFile.write((char*)&size, sizeof(qint32));
-        newFile.write((char*)compressed.data.data.data(), size);
+        return written;
+    }
 
-        newFile.close();
+    emit error("File can't be opened: " + newPath);
+    return false;
+}
+
+void ImageHandler::notCompressed(const QString& newPath, quint64 imageBytes, quint64 fileBytes)
+{
+    // the image stays as it is, a result of an earlier version of it would be taken for the current one
+    QFile::remove(newPath);
+    emit error(QString("Not compressed, %1 bytes of image would take %2 bytes: ").arg(imageBytes).arg(fileBytes) + newPath);
+}
+
+bool ImageHandler::reuseCachedResult(quint64 hash, const QString& newPath)
+{
+    QString cachedPath = resultCache.findResult(hash);
+
+    if(cachedPath.isEmpty())
+    {
+        return false;
     }
-    else
+
+    if(cachedPath != newPath)
     {
-        emit error("File can't be opened: " + newPath);
+        // an identical image under another name, its result is copied instead of compressing again
+        QFile::remove(newPath);
+
+        if(!QFile::copy(cachedPath, newPath))
+        {
+            return false;
+        }
+
+        resultCache.addResult(hash, newPath);
     }
+
+    return true;
 }
 
 OriginalImageData ImageHandler::getImageDataFromImage(const QString &path)
 {
+    IMAGECOMPRESSOR_TRACE_SPAN("load bmp");
     OriginalImageData data;
 
     QImage image(path);
@@ -131,6 +410,12 @@ OriginalImageData ImageHandler::getImageDataFromImage(const QString &path)
         data.recoveryData.originalImageWidth = image.width();
         data.recoveryData.colorTable = image.colorTable();
         data.recoveryData.format = image.format();
+
+        // BGR(A) bytes are compressed one channel at a time, so white paper stays WHITE groups
+        if(image.depth() == 24 || image.depth() == 32)
+        {
+            data.planarChannels = image.depth() / 8;
+        }
     }
     else
     {
@@ -141,75 +426,66 @@ OriginalImageData ImageHandler::getImageDataFromImage(const QString &path)
 }
 
 CompressedImageData ImageHandler::getCompressedImageDataFromFile(const QString &path)
+{
+    IMAGECOMPRESSOR_TRACE_SPAN("load barch");
+    QString errorText;
+    CompressedImageData data = readCompressedImageFile(path, errorText);
+
+    if(!data.isValid)
+    {
+        emit error(errorText);
+    }
+
+    return data;
+}
+
+CompressedImageData readCompressedImageFile(const QString &path, QString &errorText)
 {
     CompressedImageData data;
 
     QFile file(path);
     file.open(QFile::ReadOnly);
-    bool noError = true;
 
     if(file.isOpen())
     {
-        int size=0;
-
-        noError&=file.read((char*)&data.recoveryData.format, sizeof(QImage::Format)) == sizeof(QImage::Format);
-        noError&=file.read((char*)&data.recoveryData.originalImageWidth, sizeof(qint32)) == sizeof(qint32);
-        noError&=file.read((char*)&size, sizeof(qint32)) == sizeof(qint32);
-
-        for(int i = 0; i<size; ++i)
-        {
-            QRgb val = 0;
-            noError&=file.read((char*)&val, sizeof(QRgb)) == sizeof(QRgb);
-
-            data.recoveryData.colorTable.push_back(val);
-        }
-
-        size=0;
-        noError&=file.read((char*)&data.data.width, sizeof(qint32)) == sizeof(qint32);
-        noError&=file.read((char*)&data.data.height, sizeof(qint32)) == sizeof(qint32);
-        noError&=file.read((char*)&size, sizeof(qint32)) == sizeof(qint32);
+        QByteArray fileData = file.readAll();
+        file.close();
 
-        data.data.compressedIndexes.reserve(size);
+        // QImage can't hold more than INT_MAX bytes, anything bigger is rejected before decompression
+        ImageCompressor::ValidationResult validation = ImageCompressor::validateImage((const ImageCompressor::BYTE*)fileData.constData(), fileData.size(), std::numeric_limits<int>::max());
 
-        for(int i = 0; i<size; ++i)
+        if(validation != ImageCompressor::ValidationResult::VALID)
         {
-            bool hasItems = false;
-            noError&=file.read((char*)&hasItems, sizeof(bool)) == sizeof(bool);
-
-            data.data.compressedIndexes.push_back(hasItems);
+            errorText = "Incorrect file data (" + QString(ImageCompressor::validationResultToString(validation)) + "): " + path;
+            return data;
         }
 
-        size = 0;
-        noError&=file.read((char*)&size, sizeof(qint32)) == sizeof(qint32);
-        data.data.data.reserve(size);
-
-        for(int i = 0; i<size; ++i)
+        try
         {
-            unsigned char symbol = 0;
-            noError&=file.read((char*)&symbol, sizeof(char)) == sizeof(char);
+            ImageCompressor::BarchImage image = ImageCompressor::deserializeImage((const ImageCompressor::BYTE*)fileData.constData(), fileData.size());
 
-            data.data.data.push_back(symbol);
+            data.recoveryData.format = static_cast<QImage::Format>(image.metadata.format);
+            data.recoveryData.originalImageWidth = image.metadata.originalImageWidth;
+            data.recoveryData.colorTable = QVector<QRgb>(image.metadata.colorTable.begin(), image.metadata.colorTable.end());
+            data.data = std::move(image.image);
+            data.isValid = true;
         }
-
-        file.close();
-
-        if(noError == false)
+        catch(const ImageCompressor::ImageCompressorException&)
         {
-            emit error("Incorrect file data: " + path);
+            errorText = "Incorrect file data: " + path;
         }
     }
     else
     {
-        emit error("File can't be opened: " + path);
+        errorText = "File can't be opened: " + path;
     }
 
-    data.isValid = noError;
-
     return data;
 }
 
 void ImageHandler::onDecompressionFinished(OriginalImageData& decompressed, const QString& path)
 {
+    IMAGECOMPRESSOR_TRACE_SPAN("store bmp");
     QString newPath = path;
     QString removeExtension = ".barch";
     newPath.remove(newPath.lastIndexOf(removeExtension), removeExtension.size());
@@ -224,6 +500,49 @@ void ImageHandler::onDecompressionFinished(OriginalImageData& decompressed, cons
     }
 }
 
+void ImageHandler::reportCorruptedBands(const ImageCompressor::DecompressionReport& report, const ImageCompressor::CompressedImage& image, const QString& path)
+{
+    if(report.corruptedBands.empty())
+    {
+        return;
+    }
+
+    QStringList rows;
+
+    for(int band : report.corruptedBands)
+    {
+        // a band of stored rows may cross planes and tiles, each part is shown as rows of its own channel or tile
+        for(const ImageCompressor::BandArea& area : ImageCompressor::bandAreas(image, band))
+        {
+            QString part = QString("%1-%2").arg(area.region.y).arg(area.region.y + area.region.height - 1);
+
+            if(image.tileWidth != 0)
+            {
+                part += QString(" columns %1-%2").arg(area.region.x).arg(area.region.x + area.region.width - 1);
+            }
+
+            if(image.planarChannels != 0)
+            {
+                part += QString(" (channel %1)").arg(area.plane);
+            }
+
+            rows.append(part);
+        }
+    }
+
+    emit error("Checksum mismatch in rows " + rows.join(", ") + " of: " + path);
+}
+
+void ImageHandler::changeFileProgress(const QString &filepath, int progress)
+{
+    QModelIndex ind = model.getModelIndexByFile(filepath);
+
+    if(ind.isValid())
+    {
+        model.setData(ind, QVariant(progress), static_cast<int>(FilesModel::FileRoles::PROGRESS_ROLE));
+    }
+}
+
 void ImageHandler::changeFileStatus(const QString &filepath, FileInfo::FileStatus status)
 {
     QModelIndex ind = model.getModelIndexByFile(filepath);
@@ -233,3 +552,14 @@ void ImageHandler::changeFileStatus(const QString &filepath, FileInfo::FileStatu
         model.setData(ind, QVariant(static_cast<int>(status)), static_cast<int>(FilesModel::FileRoles::STATUS_ROLE));
     }
 }
+
+void ImageHandler::showFileMetrics(const QString &filepath, quint64 imageBytes, quint64 compressedBytes, double codecMs)
+{
+    QModelIndex ind = model.getModelIndexByFile(filepath);
+
+    if(ind.isValid() && compressedBytes != 0 && codecMs > 0)
+    {
+        model.setData(ind, QVariant(static_cast<double>(imageBytes) / compressedBytes), static_cast<int>(FilesModel::FileRoles::RATIO_ROLE));
+        model.setData(ind, QVariant(imageBytes / 1e3 / codecMs), static_cast<int>(FilesModel::FileRoles::THROUGHPUT_ROLE));
+    }
+}
@@ -3,14 +3,19 @@
 
 #include <QObject>
 #include <QFuture>
+#include <QFutureInterface>
 #include <QFutureWatcher>
+#include <QHash>
 #include <QVector>
 #include <QPair>
 #include <QString>
 #include <QRgb>
 #include <QImage>
 #include "FilesModel.h"
+#include "ResultCache.h"
+#include "CodecMetrics.h"
 #include "ImageCompressor.h"
+#include "BarchFile.h"
 
 struct RecoveryImageData
 {
@@ -23,6 +28,7 @@ struct OriginalImageData
 {
     ImageCompressor::RawImageData data;
     RecoveryImageData recoveryData;
+    int planarChannels = 0; // bytes per pixel of 24/32-bit images, 0 for the rest
 };
 
 struct CompressedImageData
@@ -32,11 +38,26 @@ struct CompressedImageData
     bool isValid = false;
 };
 
+// What a compression finds out on its thread, read by its watcher once it is finished.
+struct CompressionState
+{
+    OriginalImageData original; // freed by the watcher
+    ImageCompressor::CodecStats stats;
+    StageTimes times;
+    quint64 resultKey = 0;
+    bool hashed = false;
+    bool reused = false; // a result of the same content and options was there, nothing was compressed
+    bool wouldNotShrink = false; // the estimated file wasn't smaller than the image, stats hold both sizes
+};
+
+// Reads and validates a .barch file, errorText is set when the file can't be used.
+CompressedImageData readCompressedImageFile(const QString& path, QString& errorText);
+
 class ImageHandler : public QObject
 {
     Q_OBJECT
 public:
-    explicit ImageHandler(FilesModel& model, QObject *parent = nullptr);
+    ImageHandler(FilesModel& model, const QString& cacheFilePath, const QString& metricsFilePath, QObject *parent = nullptr);
 
 public slots:
     void onClickFile(int index);
@@ -45,15 +66,25 @@ signals:
     void error(const QString error);
 
 private:
+    void compressFile(const QString& path, const QString& newPath, CompressionState& state, QFutureInterface<ImageCompressor::CompressedImage>& task);
+    void finishJob(const QString& path);
     void changeFileStatus(const QString& filepath, FileInfo::FileStatus status);
+    void changeFileProgress(const QString& filepath, int progress);
+    void showFileMetrics(const QString& filepath, quint64 imageBytes, quint64 compressedBytes, double codecMs);
     void onDecompressionFinished(OriginalImageData& decompressed, const QString& path);
-    void onCompressionFinished(CompressedImageData& compressed, const QString& path);
+    bool onCompressionFinished(CompressedImageData& compressed, const QString& newPath, quint64 imageBytes);
+    void notCompressed(const QString& newPath, quint64 imageBytes, quint64 fileBytes);
+    bool reuseCachedResult(quint64 hash, const QString& newPath);
+    void reportCorruptedBands(const ImageCompressor::DecompressionReport& report, const ImageCompressor::CompressedImage& image, const QString& path);
 
     OriginalImageData getImageDataFromImage(const QString& path);
     CompressedImageData getCompressedImageDataFromFile(const QString& path);
 
 private:
     FilesModel& model;
+    ResultCache resultCache;
+    CodecMetrics metrics;
+    QHash<QString, QFutureWatcherBase*> jobs; // running conversions by source file, a click on one cancels it
 };
 
 #endif // IMAGEHANDLER_H
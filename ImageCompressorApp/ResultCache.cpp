@@ -0,0 +1,211 @@
+#include "ResultCache.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include "XxHash.h"
+
+namespace
+{
+const int HASH_CHUNK_BYTES = 1 << 20;
+}
+
+ResultCache::ResultCache(const QString& cacheFilePath) : cacheFilePath{cacheFilePath}
+{
+    load();
+}
+
+ResultCache::~ResultCache()
+{
+    save();
+}
+
+bool ResultCache::contentHash(const QString& path, quint64& hash)
+{
+    FileStamp stamp = fileStamp(path);
+
+    {
+        QMutexLocker locker(&mutex);
+        auto it = sources.find(path);
+
+        if(it != sources.end() && it->stamp.size == stamp.size && it->stamp.modified == stamp.modified)
+        {
+            hash = it->hash;
+            return true;
+        }
+    }
+
+    QFile file(path);
+
+    if(!file.open(QFile::ReadOnly))
+    {
+        return false;
+    }
+
+    // hashed a chunk at a time, so a large scan isn't held twice while it is compressed
+    ImageCompressor::XxHash64 state;
+    QByteArray chunk(HASH_CHUNK_BYTES, Qt::Uninitialized);
+    qint64 read;
+
+    while((read = file.read(chunk.data(), chunk.size())) > 0)
+    {
+        state.update((const unsigned char*)chunk.constData(), static_cast<size_t>(read));
+    }
+
+    file.close();
+
+    if(read < 0)
+    {
+        return false;
+    }
+
+    SourceEntry entry;
+    entry.stamp = stamp;
+    entry.hash = state.digest();
+
+    QMutexLocker locker(&mutex);
+    sources[path] = entry;
+    changed = true;
+
+    hash = entry.hash;
+    return true;
+}
+
+quint64 ResultCache::resultKey(quint64 contentHash, const ImageCompressor::CompressionOptions& options)
+{
+    // every option which changes the stream, hashed with the content's hash as seed
+    const qint64 fields[] = {options.bandChecksums, options.rowsPerBand, static_cast<qint64>(options.payloadCoding), options.leftPrediction,
+                             options.rowFilters, options.planarChannels, options.pixelsPerRow, options.tileWidth, options.tileHeight,
+                             options.rowHashes};
+
+    return ImageCompressor::xxhash64(reinterpret_cast<const unsigned char*>(fields), sizeof(fields), contentHash);
+}
+
+QString ResultCache::findResult(quint64 key)
+{
+    QMutexLocker locker(&mutex);
+    auto it = results.find(key);
+
+    if(it == results.end())
+    {
+        return QString();
+    }
+
+    FileStamp stamp = fileStamp(it->path);
+
+    // a result which was removed or written over since is forgotten
+    if(stamp.size < 0 || stamp.size != it->stamp.size || stamp.modified != it->stamp.modified)
+    {
+        results.erase(it);
+        changed = true;
+        return QString();
+    }
+
+    return it->path;
+}
+
+void ResultCache::addResult(quint64 key, const QString& resultPath)
+{
+    ResultEntry entry;
+    entry.stamp = fileStamp(resultPath);
+    entry.path = resultPath;
+
+    QMutexLocker locker(&mutex);
+    results[key] = entry;
+    changed = true;
+}
+
+ResultCache::FileStamp ResultCache::fileStamp(const QString& path)
+{
+    QFileInfo info(path);
+    FileStamp stamp;
+
+    if(info.exists())
+    {
+        stamp.size = info.size();
+        stamp.modified = info.lastModified().toMSecsSinceEpoch();
+    }
+
+    return stamp;
+}
+
+void ResultCache::load()
+{
+    QFile file(cacheFilePath);
+
+    if(!file.open(QFile::ReadOnly))
+    {
+        return;
+    }
+
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    QJsonObject sourcesObject = root["sources"].toObject();
+    QJsonObject resultsObject = root["results"].toObject();
+
+    for(auto it = sourcesObject.begin(); it != sourcesObject.end(); ++it)
+    {
+        QJsonObject object = it.value().toObject();
+        SourceEntry entry;
+        entry.stamp.size = static_cast<qint64>(object["size"].toDouble());
+        entry.stamp.modified = static_cast<qint64>(object["modified"].toDouble());
+        entry.hash = object["hash"].toString().toULongLong(nullptr, 16);
+        sources[it.key()] = entry;
+    }
+
+    for(auto it = resultsObject.begin(); it != resultsObject.end(); ++it)
+    {
+        QJsonObject object = it.value().toObject();
+        ResultEntry entry;
+        entry.stamp.size = static_cast<qint64>(object["size"].toDouble());
+        entry.stamp.modified = static_cast<qint64>(object["modified"].toDouble());
+        entry.path = object["path"].toString();
+        results[it.key().toULongLong(nullptr, 16)] = entry;
+    }
+}
+
+void ResultCache::save()
+{
+    QMutexLocker locker(&mutex);
+
+    if(!changed)
+    {
+        return;
+    }
+
+    QJsonObject sourcesObject;
+    QJsonObject resultsObject;
+
+    // hashes are 64-bit, so they are kept as hex strings rather than JSON numbers
+    for(auto it = sources.begin(); it != sources.end(); ++it)
+    {
+        QJsonObject object;
+        object["size"] = static_cast<double>(it->stamp.size);
+        object["modified"] = static_cast<double>(it->stamp.modified);
+        object["hash"] = QString::number(it->hash, 16);
+        sourcesObject[it.key()] = object;
+    }
+
+    for(auto it = results.begin(); it != results.end(); ++it)
+    {
+        QJsonObject object;
+        object["size"] = static_cast<double>(it->stamp.size);
+        object["modified"] = static_cast<double>(it->stamp.modified);
+        object["path"] = it->path;
+        resultsObject[QString::number(it.key(), 16)] = object;
+    }
+
+    QJsonObject root;
+    root["sources"] = sourcesObject;
+    root["results"] = resultsObject;
+
+    QFile file(cacheFilePath);
+
+    if(file.open(QFile::WriteOnly))
+    {
+        changed = file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) < 0;
+        file.close();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include "ImageCompressor.h"
+
+// Remembers which .barch file was made from which content, so unchanged or identical images aren't
+// compressed again. Kept as JSON next to the images. Sources are known by path, size and modification
+// time, so their content is hashed once; results are known by the XXH64 of the content they were made of
+// and the options they were compressed with. Every method may be called from any thread.
+class ResultCache
+{
+public:
+    explicit ResultCache(const QString& cacheFilePath);
+    ~ResultCache();
+
+    // XXH64 of the file's content, returns false if the file can't be read. The file is read without holding the cache.
+    bool contentHash(const QString& path, quint64& hash);
+    // key of the result of content with this hash compressed with options
+    static quint64 resultKey(quint64 contentHash, const ImageCompressor::CompressionOptions& options);
+    // result with this key which is still on disk unchanged, empty if there is none
+    QString findResult(quint64 key);
+    void addResult(quint64 key, const QString& resultPath);
+    // writes the cache if it changed since it was last written, changes are only kept in memory until then
+    void save();
+
+private:
+    struct FileStamp
+    {
+        qint64 size = -1;
+        qint64 modified = -1;
+    };
+
+    struct SourceEntry
+    {
+        FileStamp stamp;
+        quint64 hash = 0;
+    };
+
+    struct ResultEntry
+    {
+        FileStamp stamp;
+        QString path;
+    };
+
+    static FileStamp fileStamp(const QString& path);
+    void load();
+
+private:
+    QString cacheFilePath;
+    QMutex mutex;
+    QHash<QString, SourceEntry> sources;
+    QHash<quint64, ResultEntry> results;
+    bool changed = false;
+};
+
+#endif // RESULTCACHE_H
@@ -4,6 +4,8 @@
 #include <QDir>
 #include "FilesModel.h"
 #include "ImageHandler.h"
+#include "BarchImageProvider.h"
+#include "Trace.h"
 
 int main(int argc, char *argv[])
 {
@@ -13,6 +15,14 @@ int main(int argc, char *argv[])
 
     QGuiApplication app(argc, argv);
 
+    // in builds with IMAGECOMPRESSOR_TRACE, BARCH_TRACE names the trace-event file written on exit
+    QByteArray tracePath = qgetenv("BARCH_TRACE");
+
+    if(!tracePath.isEmpty())
+    {
+        ImageCompressor::Trace::start(tracePath.toStdString());
+    }
+
     QDir dir;
     QString path = dir.absolutePath();
 
@@ -22,11 +32,12 @@ int main(int argc, char *argv[])
     }
 
     FilesModel model(path);
-    ImageHandler imageHandler(model);
+    ImageHandler imageHandler(model, QDir(path).filePath(".barch_cache.json"), QDir(path).filePath(".barch_metrics.json"));
 
     QQmlApplicationEngine engine;
     engine.rootContext()->setContextProperty("fileModel", &model);
     engine.rootContext()->setContextProperty("imageHandler", &imageHandler);
+    engine.addImageProvider("barch", new BarchImageProvider());
     const QUrl url(QStringLiteral("qrc:/main.qml"));
     QObject::connect(&engine, &QQmlApplicationEngine::objectCreated,
                      &app, [url](QObject *obj, const QUrl &objUrl) {
@@ -31,10 +31,15 @@ Window {
                         anchors.fill: parent
                         anchors.margins: 20
 
+                        Text{
+                            text : "preview"
+                            Layout.preferredWidth: 50
+                        }
+
                         Text{
                             wrapMode: Text.WrapAnywhere
                             text : "filename"
-                            Layout.preferredWidth: listView.width * (4/6)
+                            Layout.preferredWidth: listView.width * (4/6) - 50
                         }
 
                         Text{
@@ -61,16 +66,40 @@ Window {
                 RowLayout{
                     anchors.fill: parent
                     anchors.margins: 20
+                    // above the row's MouseArea, so a click on the preview opens it instead of converting the file
+                    z: 1
+
+                    Image{
+                        id: preview
+                        Layout.preferredWidth: 50
+                        Layout.preferredHeight: 50
+                        fillMode: Image.PreserveAspectFit
+                        asynchronous: true
+                        cache: false
+                        sourceSize.width: 50
+                        sourceSize.height: 50
+                        source: filename.endsWith(".barch") ? "image://barch/" + encodeURIComponent(filename) : ""
+
+                        MouseArea{
+                            anchors.fill: parent
+                            enabled: preview.status === Image.Ready
+                            onClicked: {
+                                imageViewer.source = preview.source
+                                imageViewer.open()
+                            }
+                        }
+                    }
 
                     Text{
                         wrapMode: Text.WrapAnywhere
                         text : filename
-                        Layout.preferredWidth: listView.width * (4/6)
+                        Layout.preferredWidth: listView.width * (4/6) - 50
                     }
 
                     Text{
                         wrapMode: Text.WrapAnywhere
-                        text : status
+                        // an idle file shows how its last compression or decompression went
+                        text : status !== "" || ratio === 0 ? status : ratio.toFixed(2) + "x, " + throughput.toFixed(1) + " MB/s"
                         Layout.preferredWidth: listView.width * (1/6)
 
                     }
@@ -89,6 +118,30 @@ Window {
         }
     }
 
+    Popup {
+        id: imageViewer
+        property url source: ""
+        width: mainWindow.width - 40
+        height: mainWindow.height - 40
+        anchors.centerIn: parent
+        modal: true
+        onClosed: source = ""
+
+        // decoded in memory by the image provider, nothing is written to disk
+        Image{
+            anchors.fill: parent
+            fillMode: Image.PreserveAspectFit
+            asynchronous: true
+            cache: false
+            source: imageViewer.source
+        }
+
+        MouseArea{
+            anchors.fill: parent
+            onClicked: imageViewer.close()
+        }
+    }
+
     Popup {
         id: errorDialog
         property string errorText: ""